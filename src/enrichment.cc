@@ -11,6 +11,258 @@
 
 namespace cycamore {
 
+namespace {
+
+// @returns the value of a least squares line through hist, one point per time
+// step ending at dt = 0, dt time steps past its last point
+double LinearForecast(const std::list<double>& hist, int dt) {
+  int n = hist.size();
+  if (n == 0) {
+    return 0;
+  } else if (n == 1) {
+    return hist.front();
+  }
+
+  double sum_x = 0;
+  double sum_y = 0;
+  double sum_xx = 0;
+  double sum_xy = 0;
+  int x = 1 - n;
+  std::list<double>::const_iterator it;
+  for (it = hist.begin(); it != hist.end(); ++it, ++x) {
+    sum_x += x;
+    sum_y += *it;
+    sum_xx += x * x;
+    sum_xy += x * *it;
+  }
+  double slope = (n * sum_xy - sum_x * sum_y) / (n * sum_xx - sum_x * sum_x);
+  double intercept = (sum_y - slope * sum_x) / n;
+  return std::max(0.0, intercept + slope * dt);
+}
+
+// U-235/U-238 abundance ratio of an assay and its inverse
+double AbundanceRatio(double x) { return x / (1 - x); }
+double RatioAssay(double r) { return r / (1 + r); }
+
+// the separative potential (value function)
+double ValueFunc(double x) { return (2 * x - 1) * std::log(x / (1 - x)); }
+double ValueFuncDeriv(double x) {
+  return 2 * std::log(x / (1 - x)) + (2 * x - 1) / (x * (1 - x));
+}
+
+// range and resolution of the optimal tails table
+const double kCascadeMinFeed = 1e-4;
+const double kCascadeMaxFeed = 0.5;
+const int kCascadeTablePoints = 256;
+
+// @returns the tails assay minimizing SWU plus feed cost per kg of product
+// for the given feed assay, by golden-section search
+double GoldenSectionTails(double feed, double swu_cost, double feed_cost) {
+  // per kg of product, SWU plus feed cost is a constant plus
+  // (xp - xf) * cost(xw), so the optimum does not depend on the product
+  double v_f = ValueFunc(feed);
+  double lo = feed * 1e-6;
+  double hi = feed * (1 - 1e-9);
+  const double kInvPhi = (std::sqrt(5.0) - 1) / 2;
+  double a = hi - kInvPhi * (hi - lo);
+  double b = lo + kInvPhi * (hi - lo);
+  double cost_a = (swu_cost * (ValueFunc(a) - v_f) + feed_cost) / (feed - a);
+  double cost_b = (swu_cost * (ValueFunc(b) - v_f) + feed_cost) / (feed - b);
+  while (hi - lo > feed * 1e-10) {
+    if (cost_a < cost_b) {
+      hi = b;
+      b = a;
+      cost_b = cost_a;
+      a = hi - kInvPhi * (hi - lo);
+      cost_a = (swu_cost * (ValueFunc(a) - v_f) + feed_cost) / (feed - a);
+    } else {
+      lo = a;
+      a = b;
+      cost_a = cost_b;
+      b = lo + kInvPhi * (hi - lo);
+      cost_b = (swu_cost * (ValueFunc(b) - v_f) + feed_cost) / (feed - b);
+    }
+  }
+  return (lo + hi) / 2;
+}
+
+// writes the bytes of a single value to os
+template <class T>
+void WriteRaw(std::ostream& os, const T& x) {
+  os.write(reinterpret_cast<const char*>(&x), sizeof(T));
+}
+
+}  // namespace
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+EnrichmentCascade::EnrichmentCascade()
+    : stages_(0), beta_(1), swu_cost_(0), feed_cost_(0) {}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void EnrichmentCascade::Init(int stages, double alpha, double swu_cost,
+                             double feed_cost) {
+  if (stages < 0) {
+    throw cyclus::ValueError("cascade stage count must not be negative");
+  } else if (stages > 0 && alpha <= 1) {
+    throw cyclus::ValueError("cascade stage separation factor must be > 1");
+  }
+
+  stages_ = stages;
+  beta_ = std::sqrt(alpha);
+  swu_cost_ = swu_cost;
+  feed_cost_ = feed_cost;
+  log_feeds_.clear();
+  opt_tails_.clear();
+  if (!enabled() || swu_cost_ <= 0 || feed_cost_ <= 0) {
+    return;
+  }
+
+  double lo = std::log(kCascadeMinFeed);
+  double hi = std::log(kCascadeMaxFeed);
+  for (int i = 0; i < kCascadeTablePoints; i++) {
+    double log_feed = lo + (hi - lo) * i / (kCascadeTablePoints - 1);
+    log_feeds_.push_back(log_feed);
+    opt_tails_.push_back(SearchTails_(std::exp(log_feed)));
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+int EnrichmentCascade::EnrichingStages(double feed, double product) const {
+  if (product <= feed) {
+    return 0;
+  }
+  double n = std::log(AbundanceRatio(product) / AbundanceRatio(feed)) /
+             std::log(beta_);
+  return static_cast<int>(std::ceil(n - cyclus::eps()));
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+int EnrichmentCascade::StrippingStages(double feed, double tails) const {
+  if (tails >= feed) {
+    return 0;
+  }
+  double n = std::log(AbundanceRatio(feed) / AbundanceRatio(tails)) /
+             std::log(beta_);
+  return static_cast<int>(std::ceil(n - cyclus::eps()));
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+bool EnrichmentCascade::CanEnrich(double feed, double product) const {
+  return feed > 0 && product < 1 &&
+         EnrichingStages(feed, product) < stages_;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double EnrichmentCascade::Tails(double feed, double product,
+                                double default_tails) const {
+  double tails = default_tails;
+  if (swu_cost_ > 0 && feed_cost_ > 0) {
+    tails = OptimalTails_(feed);
+  }
+
+  int n_strip = stages_ - EnrichingStages(feed, product);
+  if (n_strip > 0) {
+    double min_tails =
+        RatioAssay(AbundanceRatio(feed) / std::pow(beta_, n_strip));
+    tails = std::max(tails, min_tails);
+  }
+  return tails;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::pair<double, double> EnrichmentCascade::SectionSwu(
+    double qty, const cyclus::toolkit::Assays& assays) const {
+  // shifting the value function by a linear term leaves total SWU unchanged,
+  // and zeroing it and its slope at the feed point attributes each section
+  // only its own product or tails stream
+  double xf = assays.Feed();
+  double v_f = ValueFunc(xf);
+  double dv_f = ValueFuncDeriv(xf);
+  double xp = assays.Product();
+  double xw = assays.Tails();
+  double tails_qty = cyclus::toolkit::TailsQty(qty, assays);
+  double enr = qty * (ValueFunc(xp) - v_f - dv_f * (xp - xf));
+  double strip = tails_qty * (ValueFunc(xw) - v_f - dv_f * (xw - xf));
+  return std::make_pair(enr, strip);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double EnrichmentCascade::OptimalTails_(double feed) const {
+  double log_feed = std::log(feed);
+  if (log_feeds_.empty() || log_feed <= log_feeds_.front() ||
+      log_feed >= log_feeds_.back()) {
+    return SearchTails_(feed);
+  }
+
+  double step = log_feeds_[1] - log_feeds_[0];
+  int i = static_cast<int>((log_feed - log_feeds_[0]) / step);
+  i = std::min(i, static_cast<int>(log_feeds_.size()) - 2);
+  double w = (log_feed - log_feeds_[i]) / step;
+  // the optimal tails scale roughly with the feed, so interpolate the ratio
+  double r_lo = opt_tails_[i] / std::exp(log_feeds_[i]);
+  double r_hi = opt_tails_[i + 1] / std::exp(log_feeds_[i + 1]);
+  return feed * ((1 - w) * r_lo + w * r_hi);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double EnrichmentCascade::SearchTails_(double feed) const {
+  return GoldenSectionTails(feed, swu_cost_, feed_cost_);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double EnrichmentMemo::Swu(cyclus::Material::Ptr m, double feed,
+                           double tails) {
+  return m->quantity() * Lookup_(m, feed, tails).swu_per_kg;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double EnrichmentMemo::NatU(cyclus::Material::Ptr m, double feed,
+                            double tails) {
+  return m->quantity() * Lookup_(m, feed, tails).natu_per_kg /
+         Comp_(m).u_frac;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+const EnrichmentMemo::CompInfo& EnrichmentMemo::Comp_(
+    cyclus::Material::Ptr m) {
+  int id = m->comp()->id();
+  std::map<int, CompInfo>::iterator it = comps_.find(id);
+  if (it != comps_.end()) {
+    return it->second;
+  }
+
+  cyclus::toolkit::MatQuery mq(m);
+  std::set<cyclus::Nuc> nucs;
+  nucs.insert(922350000);
+  nucs.insert(922380000);
+  CompInfo info;
+  info.assay = cyclus::toolkit::UraniumAssay(m);
+  info.u_frac = mq.mass_frac(nucs);
+  return comps_[id] = info;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+const EnrichmentMemo::Entry& EnrichmentMemo::Lookup_(cyclus::Material::Ptr m,
+                                                     double feed,
+                                                     double tails) {
+  double product = Comp_(m).assay;
+  if (cascade_ != NULL && cascade_->enabled()) {
+    tails = cascade_->Tails(feed, product, tails);
+  }
+  std::tuple<double, double, double> key(feed, product, tails);
+  std::map<std::tuple<double, double, double>, Entry>::iterator it =
+      entries_.find(key);
+  if (it != entries_.end()) {
+    return it->second;
+  }
+
+  cyclus::toolkit::Assays assays(feed, product, tails);
+  Entry e;
+  e.swu_per_kg = cyclus::toolkit::SwuRequired(1, assays);
+  e.natu_per_kg = cyclus::toolkit::FeedQty(1, assays);
+  return entries_[key] = e;
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 Enrichment::Enrichment(cyclus::Context* ctx)
     : cyclus::Facility(ctx),
@@ -22,11 +274,44 @@ Enrichment::Enrichment(cyclus::Context* ctx)
       feed_recipe(""),
       product_commod(""),
       tails_commod(""),
-      order_prefs(true) {}
+      order_prefs(true),
+      tails_bucket(1e-4),
+      trace_size(0),
+      capacity_assay(0.045),
+      forecast_window(12),
+      feed_recipe_assay_(0),
+      record_level("trade"),
+      record_level_(kTradeLevel),
+      trace_count_(0),
+      cascade_stages(0),
+      stage_alpha(1.3),
+      swu_cost(0),
+      feed_cost(0),
+      feed_pool_width(0),
+      intra_timestep_swu_(0),
+      intra_timestep_feed_(0),
+      pools_stale_(true) {}
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 Enrichment::~Enrichment() {}
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::InitFrom(Enrichment* m) {
+  #pragma cyclus impl initfromcopy cycamore::Enrichment
+  cyclus::toolkit::CommodityProducer::Copy(m);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::InitFrom(cyclus::QueryableBackend* b) {
+  #pragma cyclus impl initfromdb cycamore::Enrichment
+
+  // the feed recipe may not be loaded yet, so the capacity is only known
+  // once the facility enters the simulation
+  namespace tk = cyclus::toolkit;
+  tk::CommodityProducer::Add(tk::Commodity(product_commod),
+                             tk::CommodInfo(0, 0));
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 std::string Enrichment::str() {
   std::stringstream ss;
@@ -39,6 +324,48 @@ std::string Enrichment::str() {
   return ss.str();
 }
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::EnterNotify() {
+  cyclus::Facility::EnterNotify();
+  try {
+    cascade_.Init(cascade_stages, stage_alpha, swu_cost, feed_cost);
+  } catch (cyclus::ValueError& e) {
+    throw cyclus::ValidationError(Agent::InformErrorMsg(e.msg()));
+  }
+
+  if (!feed_recipes.empty() && feed_recipes.size() != feed_commods.size()) {
+    throw cyclus::ValidationError(Agent::InformErrorMsg(
+        "feed_recipes must be empty or the same length as feed_commods"));
+  }
+
+  if (record_level == "trade") {
+    record_level_ = kTradeLevel;
+  } else if (record_level == "assay") {
+    record_level_ = kAssayLevel;
+  } else if (record_level == "step") {
+    record_level_ = kStepLevel;
+  } else {
+    throw cyclus::ValidationError(Agent::InformErrorMsg(
+        "record_level must be one of 'trade', 'assay' or 'step', not '" +
+        record_level + "'"));
+  }
+
+  if (forecast_window < 1) {
+    throw cyclus::ValidationError(Agent::InformErrorMsg(
+        "forecast_window must be at least 1"));
+  }
+
+  try {
+    feed_recipe_assay_ = cyclus::toolkit::UraniumAssay(
+        cyclus::Material::CreateUntracked(
+            1, context()->GetRecipe(feed_recipe)));
+  } catch (cyclus::KeyError& e) {
+    throw cyclus::ValidationError(Agent::InformErrorMsg(
+        "feed_recipe '" + feed_recipe + "' is not a known recipe"));
+  }
+  UpdateCapacity_();
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 void Enrichment::Build(cyclus::Agent* parent) {
   using cyclus::Material;
@@ -47,6 +374,7 @@ void Enrichment::Build(cyclus::Agent* parent) {
   if (initial_feed > 0) {
     inventory.Push(Material::Create(this, initial_feed,
                                     context()->GetRecipe(feed_recipe)));
+    pools_stale_ = true;
   }
 
   LOG(cyclus::LEV_DEBUG2, "EnrFac") << "Enrichment "
@@ -55,7 +383,14 @@ void Enrichment::Build(cyclus::Agent* parent) {
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-void Enrichment::Tick() { current_swu_capacity = SwuCapacity(); }
+void Enrichment::Tick() {
+  current_swu_capacity = SwuCapacity();
+  intra_timestep_swu_ = 0;
+  intra_timestep_feed_ = 0;
+
+  // keep the reported capacity in line with the feed actually on hand
+  UpdateCapacity_();
+}
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 void Enrichment::Tock() {
@@ -66,6 +401,14 @@ void Enrichment::Tock() {
   LOG(cyclus::LEV_INFO4, "EnrFac") << prototype() << " used "
                                    << intra_timestep_feed_ << " feed";
   RecordTimeSeries<cyclus::toolkit::ENRICH_FEED>(this, intra_timestep_feed_);
+  FlushEnrichments_();
+
+  swu_history.push_back(intra_timestep_swu_);
+  feed_history.push_back(intra_timestep_feed_);
+  while (static_cast<int>(swu_history.size()) > forecast_window) {
+    swu_history.pop_front();
+    feed_history.pop_front();
+  }
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -81,7 +424,19 @@ Enrichment::GetMatlRequests() {
   double amt = mat->quantity();
 
   if (amt > cyclus::eps_rsrc()) {
-    port->AddRequest(mat, this, feed_commod);
+    std::vector<Request<Material>*> reqs;
+    reqs.push_back(port->AddRequest(mat, this, feed_commod));
+    for (int i = 0; i < feed_commods.size(); i++) {
+      Material::Ptr m = mat;
+      if (!feed_recipes.empty()) {
+        m = Material::CreateUntracked(
+            amt, context()->GetRecipe(feed_recipes[i]));
+      }
+      reqs.push_back(port->AddRequest(m, this, feed_commods[i]));
+    }
+    if (reqs.size() > 1) {
+      port->AddMutualReqs(reqs);
+    }
     ports.insert(port);
   }
 
@@ -89,16 +444,9 @@ Enrichment::GetMatlRequests() {
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-bool SortBids(cyclus::Bid<cyclus::Material>* i,
-              cyclus::Bid<cyclus::Material>* j) {
-  cyclus::Material::Ptr mat_i = i->offer();
-  cyclus::Material::Ptr mat_j = j->offer();
-
-  cyclus::toolkit::MatQuery mq_i(mat_i);
-  cyclus::toolkit::MatQuery mq_j(mat_j);
-
-  return ((mq_i.mass(922350000) / mq_i.qty()) <=
-          (mq_j.mass(922350000) / mq_j.qty()));
+bool SortBids(const std::pair<double, cyclus::Bid<cyclus::Material>*>& i,
+              const std::pair<double, cyclus::Bid<cyclus::Material>*>& j) {
+  return i.first < j.first;
 }
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 // Sort offers of input material to have higher preference for more
@@ -113,36 +461,37 @@ void Enrichment::AdjustMatlPrefs(
     return;
   }
 
+  // U-235 mass fractions are computed once per offer composition and
+  // reused across every request this time step
+  u235_fracs_.clear();
+
   cyclus::PrefMap<cyclus::Material>::type::iterator reqit;
 
   // Loop over all requests
   for (reqit = prefs.begin(); reqit != prefs.end(); ++reqit) {
-    std::vector<Bid<Material>*> bids_vector;
+    sorted_bids_.clear();
     std::map<Bid<Material>*, double>::iterator mit;
     for (mit = reqit->second.begin(); mit != reqit->second.end(); ++mit) {
       Bid<Material>* bid = mit->first;
-      bids_vector.push_back(bid);
+      sorted_bids_.push_back(std::make_pair(U235Frac_(bid->offer()), bid));
     }
-    std::sort(bids_vector.begin(), bids_vector.end(), SortBids);
+    std::stable_sort(sorted_bids_.begin(), sorted_bids_.end(), SortBids);
 
     // Assign preferences to the sorted vector
-    double n_bids = bids_vector.size();
     bool u235_mass = 0;
 
-    for (int bidit = 0; bidit < bids_vector.size(); bidit++) {
+    for (int bidit = 0; bidit < sorted_bids_.size(); bidit++) {
       int new_pref = bidit + 1;
 
       // For any bids with U-235 qty=0, set pref to zero.
       if (!u235_mass) {
-        cyclus::Material::Ptr mat = bids_vector[bidit]->offer();
-        cyclus::toolkit::MatQuery mq(mat);
-        if (mq.mass(922350000) == 0) {
+        if (sorted_bids_[bidit].first == 0) {
           new_pref = -1;
         } else {
           u235_mass = true;
         }
       }
-      (reqit->second)[bids_vector[bidit]] = new_pref;
+      (reqit->second)[sorted_bids_[bidit].second] = new_pref;
     }  // each bid
   }    // each Material Request
 }
@@ -176,14 +525,16 @@ std::set<cyclus::BidPortfolio<cyclus::Material>::Ptr> Enrichment::GetMatlBids(
   if ((out_requests.count(tails_commod) > 0) && (tails.quantity() > 0)) {
     BidPortfolio<Material>::Ptr tails_port(new BidPortfolio<Material>());
 
+    // tails are consolidated into one lot per assay bucket, so offering
+    // every lot against every request keeps the bid count small while
+    // preserving the variation in composition between buckets
+    MatVec mats = tails.PopN(tails.count());
+    tails.Push(mats);
+
     std::vector<Request<Material>*>& tails_requests =
         out_requests[tails_commod];
     std::vector<Request<Material>*>::iterator it;
     for (it = tails_requests.begin(); it != tails_requests.end(); ++it) {
-      // offer bids for all tails material, keeping discrete quantities
-      // to preserve possible variation in composition
-      MatVec mats = tails.PopN(tails.count());
-      tails.Push(mats);
       for (int k = 0; k < mats.size(); k++) {
         Material::Ptr m = mats[k];
         Request<Material>* req = *it;
@@ -205,6 +556,10 @@ std::set<cyclus::BidPortfolio<cyclus::Material>::Ptr> Enrichment::GetMatlBids(
 
     std::vector<Request<Material>*>& commod_requests =
         out_requests[product_commod];
+    offer_comps_.clear();
+    // trades draw from whichever pool is cheapest, so bid and constrain by
+    // the leanest pool, which needs the most stages, SWU and feed
+    double feed_assay = MinFeedAssay_();
     std::vector<Request<Material>*>::iterator it;
     for (it = commod_requests.begin(); it != commod_requests.end(); ++it) {
       Request<Material>* req = *it;
@@ -212,14 +567,19 @@ std::set<cyclus::BidPortfolio<cyclus::Material>::Ptr> Enrichment::GetMatlBids(
       double request_enrich = cyclus::toolkit::UraniumAssay(mat);
       if (ValidReq(req->target()) &&
           ((request_enrich < max_enrich) ||
-           (cyclus::AlmostEq(request_enrich, max_enrich)))) {
+           (cyclus::AlmostEq(request_enrich, max_enrich))) &&
+          (!cascade_.enabled() ||
+           cascade_.CanEnrich(feed_assay, request_enrich))) {
         Material::Ptr offer = Offer_(req->target());
         commod_port->AddBid(req, offer, this);
       }
     }
 
-    Converter<Material>::Ptr sc(new SWUConverter(FeedAssay(), tails_assay));
-    Converter<Material>::Ptr nc(new NatUConverter(FeedAssay(), tails_assay));
+    conv_memo_.reset(new EnrichmentMemo(&cascade_));
+    Converter<Material>::Ptr sc(
+        new SWUConverter(feed_assay, tails_assay, conv_memo_));
+    Converter<Material>::Ptr nc(
+        new NatUConverter(feed_assay, tails_assay, conv_memo_));
     CapacityConstraint<Material> swu(swu_capacity, sc);
     CapacityConstraint<Material> natu(inventory.quantity(), nc);
     commod_port->AddConstraint(swu);
@@ -250,9 +610,6 @@ void Enrichment::GetMatlTrades(
   using cyclus::Material;
   using cyclus::Trade;
 
-  intra_timestep_swu_ = 0;
-  intra_timestep_feed_ = 0;
-
   std::vector<Trade<Material> >::const_iterator it;
   for (it = trades.begin(); it != trades.end(); ++it) {
     double qty = it->amt;
@@ -289,29 +646,34 @@ void Enrichment::GetMatlTrades(
 }
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 void Enrichment::AddMat_(cyclus::Material::Ptr mat) {
-  // Elements and isotopes other than U-235, U-238 are sent directly to tails
-  cyclus::CompMap cm = mat->comp()->atom();
-  bool extra_u = false;
-  bool other_elem = false;
-  for (cyclus::CompMap::const_iterator it = cm.begin(); it != cm.end(); ++it) {
-    if (pyne::nucname::znum(it->first) == 92) {
-      if (pyne::nucname::anum(it->first) != 235 &&
-          pyne::nucname::anum(it->first) != 238 && it->second > 0) {
-        extra_u = true;
+  // Elements and isotopes other than U-235, U-238 are sent directly to tails.
+  // Feed comes from a handful of recipes, so each composition is only checked
+  // and warned about the first time it is seen.
+  if (checked_comps_.insert(mat->comp()->id()).second) {
+    const cyclus::CompMap& cm = mat->comp()->atom();
+    bool extra_u = false;
+    bool other_elem = false;
+    cyclus::CompMap::const_iterator it;
+    for (it = cm.begin(); it != cm.end(); ++it) {
+      if (pyne::nucname::znum(it->first) == 92) {
+        if (pyne::nucname::anum(it->first) != 235 &&
+            pyne::nucname::anum(it->first) != 238 && it->second > 0) {
+          extra_u = true;
+        }
+      } else if (it->second > 0) {
+        other_elem = true;
       }
-    } else if (it->second > 0) {
-      other_elem = true;
     }
-  }
-  if (extra_u) {
-    cyclus::Warn<cyclus::VALUE_WARNING>(
-        "More than 2 isotopes of U.  "
-        "Istopes other than U-235, U-238 are sent directly to tails.");
-  }
-  if (other_elem) {
-    cyclus::Warn<cyclus::VALUE_WARNING>(
-        "Non-uranium elements are "
-        "sent directly to tails.");
+    if (extra_u) {
+      cyclus::Warn<cyclus::VALUE_WARNING>(
+          "More than 2 isotopes of U.  "
+          "Istopes other than U-235, U-238 are sent directly to tails.");
+    }
+    if (other_elem) {
+      cyclus::Warn<cyclus::VALUE_WARNING>(
+          "Non-uranium elements are "
+          "sent directly to tails.");
+    }
   }
 
   LOG(cyclus::LEV_INFO5, "EnrFac") << prototype() << " is initially holding "
@@ -323,6 +685,7 @@ void Enrichment::AddMat_(cyclus::Material::Ptr mat) {
     e.msg(Agent::InformErrorMsg(e.msg()));
     throw e;
   }
+  pools_stale_ = true;
 
   LOG(cyclus::LEV_INFO5, "EnrFac")
       << prototype() << " added " << mat->quantity() << " of " << feed_commod
@@ -339,12 +702,15 @@ cyclus::Material::Ptr Enrichment::Request_() {
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 cyclus::Material::Ptr Enrichment::Offer_(cyclus::Material::Ptr mat) {
-  cyclus::toolkit::MatQuery q(mat);
-  cyclus::CompMap comp;
-  comp[922350000] = q.atom_frac(922350000);
-  comp[922380000] = q.atom_frac(922380000);
-  return cyclus::Material::CreateUntracked(
-      mat->quantity(), cyclus::Composition::CreateFromAtom(comp));
+  cyclus::Composition::Ptr& c = offer_comps_[mat->comp()->id()];
+  if (!c) {
+    cyclus::toolkit::MatQuery q(mat);
+    cyclus::CompMap comp;
+    comp[922350000] = q.atom_frac(922350000);
+    comp[922380000] = q.atom_frac(922380000);
+    c = cyclus::Composition::CreateFromAtom(comp);
+  }
+  return cyclus::Material::CreateUntracked(mat->quantity(), c);
 }
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 cyclus::Material::Ptr Enrichment::Enrich_(cyclus::Material::Ptr mat,
@@ -357,35 +723,39 @@ cyclus::Material::Ptr Enrichment::Enrich_(cyclus::Material::Ptr mat,
   using cyclus::toolkit::FeedQty;
   using cyclus::toolkit::TailsQty;
 
-  // get enrichment parameters
-  Assays assays(FeedAssay(), UraniumAssay(mat), tails_assay);
+  if (inventory.empty()) {
+    throw cyclus::ValueError(Agent::InformErrorMsg("has no feed to enrich"));
+  }
+
+  // get enrichment parameters from the feed pool this trade draws on
+  UpdatePools_();
+  double product_assay = UraniumAssay(mat);
+  int k = SelectPool_(product_assay, qty);
+  double feed_assay = FeedAssay();
+  double natu_frac = 0;
+  if (k >= 0) {
+    feed_assay = pools_[k].assay;
+    natu_frac = pools_[k].natu_frac;
+  } else {
+    // Determine the composition of the natural uranium
+    // (ie. U-235+U-238/TotalMass)
+    for (int i = 0; i < pools_.size(); i++) {
+      natu_frac += pools_[i].natu_frac * pools_[i].qty;
+    }
+    natu_frac /= inventory.quantity();
+  }
+  Assays assays(feed_assay, product_assay,
+                TailsAssay_(feed_assay, product_assay));
   double swu_req = SwuRequired(qty, assays);
   double natu_req = FeedQty(qty, assays);
-
-  // Determine the composition of the natural uranium
-  // (ie. U-235+U-238/TotalMass)
-  double pop_qty = inventory.quantity();
-  Material::Ptr natu_matl = inventory.Pop(pop_qty, cyclus::eps_rsrc());
-  inventory.Push(natu_matl);
-
-  cyclus::toolkit::MatQuery mq(natu_matl);
-  std::set<cyclus::Nuc> nucs;
-  nucs.insert(922350000);
-  nucs.insert(922380000);
-  double natu_frac = mq.mass_frac(nucs);
   double feed_req = natu_req / natu_frac;
 
   // pop amount from inventory and blob it into one material
   Material::Ptr r;
   try {
-    // required so popping doesn't take out too much
-    if (cyclus::AlmostEq(feed_req, inventory.quantity())) {
-      r = cyclus::toolkit::Squash(inventory.PopN(inventory.count()));
-    } else {
-      r = inventory.Pop(feed_req, cyclus::eps_rsrc());
-    }
+    r = DrawFeed_(k, feed_req);
   } catch (cyclus::Error& e) {
-    NatUConverter nc(FeedAssay(), tails_assay);
+    NatUConverter nc(assays.Feed(), assays.Tails());
     std::stringstream ss;
     ss << " tried to remove " << feed_req << " from its inventory of size "
        << inventory.quantity()
@@ -398,63 +768,429 @@ cyclus::Material::Ptr Enrichment::Enrich_(cyclus::Material::Ptr mat,
   // blob
   cyclus::Composition::Ptr comp = mat->comp();
   Material::Ptr response = r->ExtractComp(qty, comp);
-  tails.Push(r);
+  PushTails_(r);
 
   current_swu_capacity -= swu_req;
 
   intra_timestep_swu_ += swu_req;
   intra_timestep_feed_ += feed_req;
-  RecordEnrichment_(feed_req, swu_req);
-
-  LOG(cyclus::LEV_INFO5, "EnrFac") << prototype()
-                                   << " has performed an enrichment: ";
-  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Feed Qty: " << feed_req;
-  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Feed Assay: "
-                                   << assays.Feed() * 100;
-  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Product Qty: " << qty;
-  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Product Assay: "
-                                   << assays.Product() * 100;
-  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Tails Qty: "
-                                   << TailsQty(qty, assays);
-  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Tails Assay: "
-                                   << assays.Tails() * 100;
-  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * SWU: " << swu_req;
-  LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Current SWU capacity: "
-                                   << current_swu_capacity;
+  RecordEnrichment_(feed_req, swu_req, qty, assays.Product());
+  if (cascade_.enabled()) {
+    RecordCascade_(qty, assays);
+  }
+
+#if CYCAMORE_ENRICH_TRACE
+  if (trace_size > 0) {
+    EnrichmentTrace t = {context()->time(), feed_req, assays.Feed(), qty,
+                         assays.Product(), TailsQty(qty, assays),
+                         assays.Tails(), swu_req, current_swu_capacity};
+    Trace_(t);
+  }
+#endif
+
+  // one level check for the whole report rather than one per line
+  if (cyclus::Logger::ReportLevel() >= cyclus::LEV_INFO5) {
+    LOG(cyclus::LEV_INFO5, "EnrFac") << prototype()
+                                     << " has performed an enrichment: ";
+    LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Feed Qty: " << feed_req;
+    LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Feed Assay: "
+                                     << assays.Feed() * 100;
+    LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Product Qty: " << qty;
+    LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Product Assay: "
+                                     << assays.Product() * 100;
+    LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Tails Qty: "
+                                     << TailsQty(qty, assays);
+    LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Tails Assay: "
+                                     << assays.Tails() * 100;
+    LOG(cyclus::LEV_INFO5, "EnrFac") << "   * SWU: " << swu_req;
+    LOG(cyclus::LEV_INFO5, "EnrFac") << "   * Current SWU capacity: "
+                                     << current_swu_capacity;
+  }
 
   return response;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-void Enrichment::RecordEnrichment_(double natural_u, double swu) {
-  using cyclus::Context;
-  using cyclus::Agent;
+double Enrichment::ProductCapacity(double product_assay) {
+  using cyclus::toolkit::Assays;
+
+  double feed = PlanningFeedAssay_();
+  if (feed <= 0) {
+    return 0;
+  }
+  double tails = TailsAssay_(feed, product_assay);
+  if (feed <= tails || product_assay <= feed) {
+    return 0;
+  }
+
+  Assays assays(feed, product_assay, tails);
+  double cap = swu_capacity / cyclus::toolkit::SwuRequired(1, assays);
+  double feed_per_kg = cyclus::toolkit::FeedQty(1, assays);
+  return std::min(cap, max_feed_inventory / feed_per_kg);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double Enrichment::ForecastSwu(int dt) const {
+  return LinearForecast(swu_history, dt);
+}
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double Enrichment::ForecastFeed(int dt) const {
+  return LinearForecast(feed_history, dt);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double Enrichment::PlanningFeedAssay_() {
+  return inventory.empty() ? feed_recipe_assay_ : FeedAssay();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::UpdateCapacity_() {
+  cyclus::toolkit::Commodity commod(product_commod);
+  if (cyclus::toolkit::CommodityProducer::Produces(commod)) {
+    cyclus::toolkit::CommodityProducer::SetCapacity(
+        commod, ProductCapacity(capacity_assay));
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::Trace_(const EnrichmentTrace& t) {
+  if (trace_ring_.size() != trace_size) {
+    trace_ring_.resize(trace_size);
+    trace_count_ = 0;
+  }
+  trace_ring_[trace_count_ % trace_size] = t;
+  trace_count_++;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+std::vector<EnrichmentTrace> Enrichment::Trace() const {
+  std::vector<EnrichmentTrace> traces;
+  int n = trace_ring_.size();
+  long start = trace_count_ > n ? trace_count_ - n : 0;
+  for (long i = start; i < trace_count_; i++) {
+    traces.push_back(trace_ring_[i % n]);
+  }
+  return traces;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::DumpTrace(std::ostream& os) const {
+  std::vector<EnrichmentTrace> traces = Trace();
+  for (int i = 0; i < traces.size(); i++) {
+    const EnrichmentTrace& t = traces[i];
+    WriteRaw(os, t.time);
+    WriteRaw(os, t.feed_qty);
+    WriteRaw(os, t.feed_assay);
+    WriteRaw(os, t.product_qty);
+    WriteRaw(os, t.product_assay);
+    WriteRaw(os, t.tails_qty);
+    WriteRaw(os, t.tails_assay);
+    WriteRaw(os, t.swu);
+    WriteRaw(os, t.swu_capacity);
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::PushTails_(cyclus::Material::Ptr mat) {
+  using cyclus::toolkit::UraniumAssay;
+
+  if (tails_bucket <= 0) {
+    tails.Push(mat);
+    return;
+  }
+
+  SyncTailsKeys_();
+  double bucket = std::floor(UraniumAssay(mat) / tails_bucket);
+  std::deque<double>::iterator it =
+      std::find(tails_keys_.begin(), tails_keys_.end(), bucket);
+  if (it == tails_keys_.end()) {
+    tails.Push(mat);
+    tails_keys_.push_back(bucket);
+    return;
+  }
+
+  int i = it - tails_keys_.begin();
+  cyclus::toolkit::MatVec lots = tails.PopN(tails.count());
+  lots[i]->Absorb(mat);
+  *it = std::floor(UraniumAssay(lots[i]) / tails_bucket);
+  tails.Push(lots);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::SyncTailsKeys_() {
+  using cyclus::toolkit::UraniumAssay;
+
+  int n = tails.count();
+  while (static_cast<int>(tails_keys_.size()) > n) {
+    tails_keys_.pop_front();
+  }
+  if (static_cast<int>(tails_keys_.size()) == n) {
+    return;
+  }
+
+  tails_keys_.clear();
+  cyclus::toolkit::MatVec lots = tails.PopN(n);
+  for (int i = 0; i < lots.size(); i++) {
+    tails_keys_.push_back(std::floor(UraniumAssay(lots[i]) / tails_bucket));
+  }
+  tails.Push(lots);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::RecordEnrichment_(double natural_u, double swu,
+                                   double product_qty, double product_assay) {
   LOG(cyclus::LEV_DEBUG1, "EnrFac") << prototype()
                                     << " has enriched a material:";
   LOG(cyclus::LEV_DEBUG1, "EnrFac") << "  * Amount: " << natural_u;
   LOG(cyclus::LEV_DEBUG1, "EnrFac") << "  *    SWU: " << swu;
 
-  Context* ctx = Agent::context();
-  ctx->NewDatum("Enrichments")
+  // find the row this enrichment is aggregated into, if any
+  EnrichmentRecord* rec = NULL;
+  switch (record_level_) {
+    case kStepLevel:
+      if (!pending_records_.empty()) {
+        rec = &pending_records_[0];
+      }
+      break;
+    case kAssayLevel:
+      for (int i = 0; i < pending_records_.size(); i++) {
+        if (pending_records_[i].product_assay == product_assay) {
+          rec = &pending_records_[i];
+          break;
+        }
+      }
+      break;
+    case kTradeLevel:
+      break;
+  }
+
+  if (rec == NULL) {
+    EnrichmentRecord r = {product_assay, product_qty, natural_u, swu, 1};
+    pending_records_.push_back(r);
+    return;
+  }
+
+  // per step rows report the product weighted mean assay
+  double tot_qty = rec->product_qty + product_qty;
+  if (tot_qty > 0) {
+    rec->product_assay = (rec->product_assay * rec->product_qty +
+                          product_assay * product_qty) / tot_qty;
+  }
+  rec->product_qty = tot_qty;
+  rec->natural_u += natural_u;
+  rec->swu += swu;
+  rec->trades++;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::FlushEnrichments_() {
+  cyclus::Context* ctx = context();
+  for (int i = 0; i < pending_records_.size(); i++) {
+    const EnrichmentRecord& r = pending_records_[i];
+    ctx->NewDatum("Enrichments")
+        ->AddVal("ID", id())
+        ->AddVal("Time", ctx->time())
+        ->AddVal("Natural_Uranium", r.natural_u)
+        ->AddVal("SWU", r.swu)
+        ->AddVal("Product_Assay", r.product_assay)
+        ->AddVal("Trades", r.trades)
+        ->Record();
+  }
+  pending_records_.clear();
+}
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double Enrichment::U235Frac_(cyclus::Material::Ptr mat) {
+  int id = mat->comp()->id();
+  std::unordered_map<int, double>::iterator it = u235_fracs_.find(id);
+  if (it != u235_fracs_.end()) {
+    return it->second;
+  }
+  cyclus::toolkit::MatQuery mq(mat);
+  return u235_fracs_[id] = mq.mass_frac(922350000);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::RecordCascade_(double qty,
+                                const cyclus::toolkit::Assays& assays) {
+  std::pair<double, double> swu = cascade_.SectionSwu(qty, assays);
+  context()
+      ->NewDatum("EnrichmentCascade")
       ->AddVal("ID", id())
-      ->AddVal("Time", ctx->time())
-      ->AddVal("Natural_Uranium", natural_u)
-      ->AddVal("SWU", swu)
+      ->AddVal("Time", context()->time())
+      ->AddVal("Product_Assay", assays.Product())
+      ->AddVal("Tails_Assay", assays.Tails())
+      ->AddVal("Enriching_Stages",
+               cascade_.EnrichingStages(assays.Feed(), assays.Product()))
+      ->AddVal("Stripping_Stages",
+               cascade_.StrippingStages(assays.Feed(), assays.Tails()))
+      ->AddVal("Enriching_SWU", swu.first)
+      ->AddVal("Stripping_SWU", swu.second)
       ->Record();
 }
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double Enrichment::TailsAssay_(double feed, double product) {
+  if (!cascade_.enabled()) {
+    return tails_assay;
+  }
+  return cascade_.Tails(feed, product, tails_assay);
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 double Enrichment::FeedAssay() {
+  if (inventory.empty()) {
+    return 0;
+  }
+  UpdatePools_();
+  if (pools_.size() == 1) {
+    return pools_[0].assay;
+  }
+
+  // U mass weighted mean of the pools
+  double u = 0;
+  double u235 = 0;
+  for (int i = 0; i < pools_.size(); i++) {
+    double u_i = pools_[i].natu_frac * pools_[i].qty;
+    u += u_i;
+    u235 += pools_[i].assay * u_i;
+  }
+  return u > 0 ? u235 / u : 0;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double Enrichment::MinFeedAssay_() {
+  if (inventory.empty()) {
+    return 0;
+  }
+  UpdatePools_();
+  double assay = pools_[0].assay;
+  for (int i = 1; i < pools_.size(); i++) {
+    assay = std::min(assay, pools_[i].assay);
+  }
+  return assay;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void Enrichment::UpdatePools_() {
   using cyclus::Material;
+  using cyclus::toolkit::MatVec;
 
+  if (!pools_stale_) {
+    return;
+  }
+  pools_stale_ = false;
+  pools_.clear();
   if (inventory.empty()) {
+    return;
+  }
+
+  // group materials by assay bucket, keeping the order buckets are first seen
+  MatVec mats = inventory.PopN(inventory.count());
+  std::vector<double> buckets;
+  std::vector<MatVec> groups;
+  for (int i = 0; i < mats.size(); i++) {
+    double bucket = 0;
+    if (feed_pool_width > 0) {
+      bucket = std::floor(cyclus::toolkit::UraniumAssay(mats[i]) /
+                          feed_pool_width);
+    }
+    int j = std::find(buckets.begin(), buckets.end(), bucket) - buckets.begin();
+    if (j == buckets.size()) {
+      buckets.push_back(bucket);
+      groups.push_back(MatVec());
+    }
+    groups[j].push_back(mats[i]);
+  }
+
+  std::set<cyclus::Nuc> nucs;
+  nucs.insert(922350000);
+  nucs.insert(922380000);
+  for (int j = 0; j < groups.size(); j++) {
+    Material::Ptr pool = groups[j].size() == 1 ?
+                         groups[j][0] : cyclus::toolkit::Squash(groups[j]);
+    cyclus::toolkit::MatQuery mq(pool);
+    FeedPool p = {cyclus::toolkit::UraniumAssay(pool), mq.mass_frac(nucs),
+                  pool->quantity()};
+    pools_.push_back(p);
+    inventory.Push(pool);
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+int Enrichment::SelectPool_(double product_assay, double qty) {
+  using cyclus::toolkit::Assays;
+
+  if (pools_.size() <= 1) {
     return 0;
   }
-  double pop_qty = inventory.quantity();
-  cyclus::Material::Ptr fission_matl =
-      inventory.Pop(pop_qty, cyclus::eps_rsrc());
-  inventory.Push(fission_matl);
-  return cyclus::toolkit::UraniumAssay(fission_matl);
+
+  bool use_costs = swu_cost > 0 && feed_cost > 0;
+  int best = -1;
+  double best_cost = 0;
+  for (int i = 0; i < pools_.size(); i++) {
+    double feed = pools_[i].assay;
+    double tails = TailsAssay_(feed, product_assay);
+    if (feed <= tails || product_assay <= feed) {
+      continue;
+    }
+
+    Assays assays(feed, product_assay, tails);
+    double swu = cyclus::toolkit::SwuRequired(qty, assays);
+    double feed_qty =
+        cyclus::toolkit::FeedQty(qty, assays) / pools_[i].natu_frac;
+    if (swu > current_swu_capacity + cyclus::eps_rsrc() ||
+        feed_qty > pools_[i].qty + cyclus::eps_rsrc()) {
+      continue;
+    }
+
+    double cost = use_costs ? swu_cost * swu + feed_cost * feed_qty : swu;
+    if (best < 0 || cost < best_cost) {
+      best = i;
+      best_cost = cost;
+    }
+  }
+  return best;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+cyclus::Material::Ptr Enrichment::DrawFeed_(int k, double qty) {
+  using cyclus::Material;
+  using cyclus::toolkit::MatVec;
+
+  MatVec mats = inventory.PopN(inventory.count());
+  if (k < 0) {
+    // no single pool can cover the trade, so blend them all
+    Material::Ptr blend = cyclus::toolkit::Squash(mats);
+    mats.clear();
+    mats.push_back(blend);
+    k = 0;
+    pools_stale_ = true;
+  }
+
+  Material::Ptr pool = mats[k];
+  if (qty > pool->quantity() + cyclus::eps_rsrc()) {
+    inventory.Push(mats);
+    std::stringstream ss;
+    ss << "cannot draw " << qty << " kg of feed from a pool of "
+       << pool->quantity() << " kg";
+    throw cyclus::ValueError(ss.str());
+  }
+
+  // required so popping doesn't take out too much
+  Material::Ptr r;
+  if (cyclus::AlmostEq(qty, pool->quantity()) || qty > pool->quantity()) {
+    r = pool;
+    mats.erase(mats.begin() + k);
+    pools_stale_ = true;
+  } else {
+    r = pool->ExtractQty(qty);
+    if (!pools_stale_) {
+      pools_[k].qty = pool->quantity();
+    }
+  }
+  inventory.Push(mats);
+  return r;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -1,21 +1,185 @@
 #ifndef CYCAMORE_SRC_ENRICHMENT_H_
 #define CYCAMORE_SRC_ENRICHMENT_H_
 
+#include <algorithm>
+#include <deque>
+#include <list>
+#include <map>
+#include <ostream>
 #include <string>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "cyclus.h"
 #include "cycamore_version.h"
 
+// Build with -DCYCAMORE_ENRICH_TRACE=0 to compile enrichment tracing out
+// entirely, independent of the trace_size set on each prototype.
+#ifndef CYCAMORE_ENRICH_TRACE
+#define CYCAMORE_ENRICH_TRACE 1
+#endif
+
 namespace cycamore {
 
+/// @struct EnrichmentTrace
+///
+/// @brief A fixed size record of a single enrichment, kept in the Enrichment
+/// facility's trace ring buffer and dumped field by field by DumpTrace.
+struct EnrichmentTrace {
+  int time;
+  double feed_qty;
+  double feed_assay;
+  double product_qty;
+  double product_assay;
+  double tails_qty;
+  double tails_assay;
+  double swu;
+  double swu_capacity;
+};
+
+/// @struct EnrichmentRecord
+///
+/// @brief Totals of one or more enrichments waiting to be written as a row of
+/// the Enrichments table at the end of the time step.
+struct EnrichmentRecord {
+  double product_assay;
+  double product_qty;
+  double natural_u;
+  double swu;
+  int trades;
+};
+
+/// @struct FeedPool
+///
+/// @brief Cached assay, U-235 + U-238 mass fraction and quantity of one
+/// homogenous pool of the Enrichment facility's feed inventory.
+struct FeedPool {
+  double assay;
+  double natu_frac;
+  double qty;
+};
+
+/// @class EnrichmentCascade
+///
+/// @brief The EnrichmentCascade models a symmetric cascade of identical
+/// stages, each multiplying the U-235/U-238 abundance ratio of its heads by
+/// beta = sqrt(alpha) relative to its feed, where alpha is the stage
+/// separation factor. A trade to product assay xp from feed assay xf needs
+/// ceil(ln(Rp / Rf) / ln(beta)) enriching stages and the rest of the cascade
+/// strips, which bounds how far the tails can be depleted.
+///
+/// Within that bound the tails assay is chosen to minimize the cost of SWU
+/// plus feed per kg of product. For an ideal cascade the optimal tails assay
+/// depends only on the feed assay and the cost ratio, so it is tabulated over
+/// feed assay once by Init and interpolated per trade.
+class EnrichmentCascade {
+ public:
+  EnrichmentCascade();
+
+  /// @brief sets up the cascade and precomputes the optimal tails table
+  /// @param stages the number of stages, 0 disables the cascade model
+  /// @param alpha the stage separation factor
+  /// @param swu_cost the cost per kg SWU
+  /// @param feed_cost the cost per kg of feed
+  void Init(int stages, double alpha, double swu_cost, double feed_cost);
+
+  /// @returns true if a cascade has been set up
+  bool enabled() const { return stages_ > 0; }
+
+  /// @returns the number of enriching stages needed to go from feed to product
+  int EnrichingStages(double feed, double product) const;
+
+  /// @returns the number of stripping stages needed to go from feed to tails
+  int StrippingStages(double feed, double tails) const;
+
+  /// @returns true if the cascade has enough stages to reach product from
+  /// feed while keeping at least one stripping stage
+  bool CanEnrich(double feed, double product) const;
+
+  /// @returns the tails assay for a trade: the cost-optimal one if costs are
+  /// set, otherwise default_tails, raised to what the stripping stages left
+  /// over by the trade can reach
+  double Tails(double feed, double product, double default_tails) const;
+
+  /// @returns the separative work done by the enriching and stripping
+  /// sections of an ideal cascade producing qty of product. The two sum to
+  /// SwuRequired(qty, assays).
+  std::pair<double, double> SectionSwu(
+      double qty, const cyclus::toolkit::Assays& assays) const;
+
+ private:
+  /// @returns the cost-optimal tails assay for the given feed assay,
+  /// interpolated from the table where possible
+  double OptimalTails_(double feed) const;
+
+  /// @returns the cost-optimal tails assay found by golden section search
+  double SearchTails_(double feed) const;
+
+  int stages_;
+  double beta_;
+  double swu_cost_;
+  double feed_cost_;
+
+  // optimal tails assay by log(feed assay), on an even grid
+  std::vector<double> log_feeds_;
+  std::vector<double> opt_tails_;
+};
+
+/// @class EnrichmentMemo
+///
+/// @brief The EnrichmentMemo is a memo table shared by the SWU and NatU
+/// converters of a single time step. SWU and feed requirements scale linearly
+/// with product quantity, so they are stored per kg of product keyed on the
+/// (feed, product, tails) assays. Product assays and U-235 + U-238 mass
+/// fractions are in turn cached per composition, so the value function is
+/// evaluated once per distinct product assay rather than once per arc.
+class EnrichmentMemo {
+ public:
+  typedef boost::shared_ptr<EnrichmentMemo> Ptr;
+
+  /// @param cascade if given and enabled, picks the tails assay of each
+  /// product assay in place of the tails passed to Swu and NatU
+  EnrichmentMemo(const EnrichmentCascade* cascade = NULL)
+      : cascade_(cascade) {}
+
+  /// @returns the SWU required to enrich m
+  double Swu(cyclus::Material::Ptr m, double feed, double tails);
+
+  /// @returns the natural uranium required to enrich m, scaled by the
+  /// U-235 + U-238 mass fraction of m
+  double NatU(cyclus::Material::Ptr m, double feed, double tails);
+
+ private:
+  struct Entry {
+    double swu_per_kg;
+    double natu_per_kg;
+  };
+
+  struct CompInfo {
+    double assay;
+    double u_frac;
+  };
+
+  const CompInfo& Comp_(cyclus::Material::Ptr m);
+  const Entry& Lookup_(cyclus::Material::Ptr m, double feed, double tails);
+
+  const EnrichmentCascade* cascade_;
+  std::map<int, CompInfo> comps_;
+  std::map<std::tuple<double, double, double>, Entry> entries_;
+};
+
 /// @class SWUConverter
 ///
 /// @brief The SWUConverter is a simple Converter class for material to
 /// determine the amount of SWU required for their proposed enrichment
 class SWUConverter : public cyclus::Converter<cyclus::Material> {
  public:
-  SWUConverter(double feed_commod, double tails) : feed_(feed_commod),
-    tails_(tails) {}
+  SWUConverter(double feed_commod, double tails,
+               EnrichmentMemo::Ptr memo = EnrichmentMemo::Ptr())
+      : feed_(feed_commod), tails_(tails), memo_(memo) {}
   virtual ~SWUConverter() {}
 
   /// @brief provides a conversion for the SWU required
@@ -24,6 +188,9 @@ class SWUConverter : public cyclus::Converter<cyclus::Material> {
       cyclus::Arc const * a = NULL,
       cyclus::ExchangeTranslationContext<cyclus::Material>
           const * ctx = NULL) const {
+    if (memo_) {
+      return memo_->Swu(m, feed_, tails_);
+    }
     cyclus::toolkit::Assays assays(feed_, cyclus::toolkit::UraniumAssay(m),
                                    tails_);
     return cyclus::toolkit::SwuRequired(m->quantity(), assays);
@@ -39,6 +206,7 @@ class SWUConverter : public cyclus::Converter<cyclus::Material> {
 
  private:
   double feed_, tails_;
+  EnrichmentMemo::Ptr memo_;
 };
 
 /// @class NatUConverter
@@ -48,8 +216,9 @@ class SWUConverter : public cyclus::Converter<cyclus::Material> {
 /// enrichment
 class NatUConverter : public cyclus::Converter<cyclus::Material> {
  public:
-  NatUConverter(double feed_commod, double tails) : feed_(feed_commod),
-    tails_(tails) {}
+  NatUConverter(double feed_commod, double tails,
+                EnrichmentMemo::Ptr memo = EnrichmentMemo::Ptr())
+      : feed_(feed_commod), tails_(tails), memo_(memo) {}
   virtual ~NatUConverter() {}
 
   virtual std::string version() { return CYCAMORE_VERSION; }
@@ -60,6 +229,9 @@ class NatUConverter : public cyclus::Converter<cyclus::Material> {
       cyclus::Arc const * a = NULL,
       cyclus::ExchangeTranslationContext<cyclus::Material>
           const * ctx = NULL) const {
+    if (memo_) {
+      return memo_->NatU(m, feed_, tails_);
+    }
     cyclus::toolkit::Assays assays(feed_, cyclus::toolkit::UraniumAssay(m),
                                    tails_);
     cyclus::toolkit::MatQuery mq(m);
@@ -82,6 +254,7 @@ class NatUConverter : public cyclus::Converter<cyclus::Material> {
 
  private:
   double feed_, tails_;
+  EnrichmentMemo::Ptr memo_;
 };
 
 ///  The Enrichment facility is a simple Agent that enriches natural
@@ -112,10 +285,17 @@ class NatUConverter : public cyclus::Converter<cyclus::Material> {
 ///  in unspecified but repeatable order.
 ///
 ///  The Enrichment facility also offers its tails as an output commodity with
-///  no associated recipe.  Bids for tails are constrained only by total
-///  tails inventory.
+///  no associated recipe.  Tails are merged into one lot per tails_bucket
+///  assay bucket as they are produced, and each lot is offered whole.  Bids
+///  for tails are constrained only by total tails inventory.
+///
+///  For institutions the Enrichment facility is a producer of its product
+///  commodity, with a capacity equal to the product its SWU capacity and feed
+///  inventory allow at capacity_assay.  It also keeps a short history of its
+///  SWU and feed use so builders can forecast its remaining headroom.
 
-class Enrichment : public cyclus::Facility {
+class Enrichment : public cyclus::Facility,
+  public cyclus::toolkit::CommodityProducer {
 #pragma cyclus note {   	  \
   "niche": "enrichment facility",				  \
   "doc":								\
@@ -160,7 +340,17 @@ class Enrichment : public cyclus::Facility {
 
   virtual std::string version() { return CYCAMORE_VERSION; }
 
-  #pragma cyclus
+  #pragma cyclus def clone
+  #pragma cyclus def schema
+  #pragma cyclus def annotations
+  #pragma cyclus def infiletodb
+  #pragma cyclus def snapshot
+  #pragma cyclus def snapshotinv
+  #pragma cyclus def initinv
+
+  virtual void InitFrom(Enrichment* m);
+
+  virtual void InitFrom(cyclus::QueryableBackend* b);
 
   ///     Print information about this agent
   virtual std::string str();
@@ -171,6 +361,9 @@ class Enrichment : public cyclus::Facility {
   virtual void Build(cyclus::Agent* parent);
   // ---
 
+  /// sets up the cascade model, if one is configured
+  virtual void EnterNotify();
+
   // --- Agent Members ---
   ///  Each facility is prompted to do its beginning-of-time-step
   ///  stuff at the tick of the timer.
@@ -239,6 +432,36 @@ class Enrichment : public cyclus::Facility {
   inline const cyclus::toolkit::ResBuf<cyclus::Material>& Tails() const {
     return tails;
   } 
+
+  /// @returns the kg of product at product_assay that a time step's SWU
+  /// capacity and a full feed inventory can make
+  double ProductCapacity(double product_assay);
+
+  /// @returns the SWU use forecast dt time steps ahead, from a linear fit to
+  /// the last forecast_window time steps
+  double ForecastSwu(int dt) const;
+
+  /// @returns the feed use forecast dt time steps ahead, from a linear fit to
+  /// the last forecast_window time steps
+  double ForecastFeed(int dt) const;
+
+  /// @returns the SWU capacity forecast to be left unused dt time steps ahead
+  inline double SwuHeadroom(int dt) const {
+    return std::max(0.0, swu_capacity - ForecastSwu(dt));
+  }
+
+  /// @returns the fraction of SWU capacity forecast to be used dt time steps
+  /// ahead
+  inline double SwuUtilization(int dt) const {
+    return swu_capacity > 0 ? ForecastSwu(dt) / swu_capacity : 0;
+  }
+
+  /// @returns the last trace_size enrichments, oldest first
+  std::vector<EnrichmentTrace> Trace() const;
+
+  /// @brief writes the last trace_size enrichments, oldest first, to os as
+  /// raw EnrichmentTrace fields in declaration order, without padding
+  void DumpTrace(std::ostream& os) const;
   
  private:
   ///   @brief adds a material into the natural uranium inventory
@@ -252,7 +475,8 @@ class Enrichment : public cyclus::Facility {
   ///  @brief Generates a material offer for a given request. The response
   ///  composition will be comprised only of U235 and U238 at their relative
   ///  ratio in the requested material. The response quantity will be the
-  ///  same as the requested commodity.
+  ///  same as the requested commodity. Offers for requests of the same
+  ///  composition share the offer composition.
   ///
   ///  @param req the requested material being responded to
   cyclus::Material::Ptr Offer_(cyclus::Material::Ptr req);
@@ -262,8 +486,64 @@ class Enrichment : public cyclus::Facility {
   ///  @brief calculates the feed assay based on the unenriched inventory
   double FeedAssay();
 
+  ///  @brief returns the tails assay used to enrich feed to product: the
+  ///  configured tails_assay, or the cascade's choice in cascade mode
+  double TailsAssay_(double feed, double product);
+
+  ///  @brief returns the U-235 mass fraction of mat, cached by composition
+  double U235Frac_(cyclus::Material::Ptr mat);
+
+  ///  @brief merges the feed inventory into one homogenous material per
+  ///  feed_pool_width assay bucket and rebuilds the pool cache, if feed has
+  ///  been added since it was last built
+  void UpdatePools_();
+
+  ///  @brief returns the lowest assay of any feed pool, the one that needs
+  ///  the most SWU and feed for a given product
+  double MinFeedAssay_();
+
+  ///  @brief picks the feed pool to enrich qty of product_assay from: the
+  ///  cheapest pool that holds enough feed within the remaining SWU capacity.
+  ///  Costs are swu_cost and feed_cost if both are set, otherwise SWU alone.
+  ///  @return the pool index, or -1 to draw from a blend of all pools
+  int SelectPool_(double product_assay, double qty);
+
+  ///  @brief removes qty of feed from pool k, or from a blend of all pools if
+  ///  k is negative
+  ///  @throws ValueError if there isn't enough feed
+  cyclus::Material::Ptr DrawFeed_(int k, double qty);
+
+  ///  @brief adds tails to the tails buffer, merging them into the lot of the
+  ///  same tails_bucket assay bucket if there is one
+  void PushTails_(cyclus::Material::Ptr mat);
+
+  ///  @brief brings tails_keys_ in line with the tails buffer, dropping the
+  ///  keys of lots popped since the last call and rebuilding them all if the
+  ///  buffer was restored without them
+  void SyncTailsKeys_();
+
+  ///  @brief returns the assay of the feed to plan capacity with: that of the
+  ///  feed inventory, or failing that of the feed recipe, which is only known
+  ///  once the facility has entered the simulation
+  double PlanningFeedAssay_();
+
+  ///  @brief sets the reported product commodity capacity to what can be made
+  ///  at capacity_assay
+  void UpdateCapacity_();
+
+  ///  @brief adds an enrichment to the trace ring buffer
+  void Trace_(const EnrichmentTrace& t);
+
   ///  @brief records and enrichment with the cyclus::Recorder
-  void RecordEnrichment_(double natural_u, double swu);
+  void RecordEnrichment_(double natural_u, double swu, double product_qty,
+                         double product_assay);
+
+  ///  @brief writes the enrichments buffered this time step to the
+  ///  Enrichments table
+  void FlushEnrichments_();
+
+  ///  @brief records the cascade stages and section SWU used by an enrichment
+  void RecordCascade_(double qty, const cyclus::toolkit::Assays& assays);
   
   #pragma cyclus var { \
     "tooltip": "feed commodity",					\
@@ -280,6 +560,41 @@ class Enrichment : public cyclus::Facility {
     "uitype": "recipe" \
   }
   std::string feed_recipe;
+
+  #pragma cyclus var { \
+    "default": [], \
+    "userlevel": 10, \
+    "uitype": ["oneOrMore", "incommodity"], \
+    "tooltip": "additional feed commodities", \
+    "uilabel": "Additional Feed Commodities", \
+    "doc": "feed commodities requested alongside feed_commod, e.g. " \
+           "reprocessed uranium. The feed inventory is shared between all " \
+           "feed commodities." \
+  }
+  std::vector<std::string> feed_commods;
+
+  #pragma cyclus var { \
+    "default": [], \
+    "userlevel": 10, \
+    "uitype": ["oneOrMore", "recipe"], \
+    "tooltip": "recipes for additional feed commodities", \
+    "uilabel": "Additional Feed Recipes", \
+    "doc": "recipes to request each of feed_commods with, in the same " \
+           "order. If empty, feed_recipe is used for all of them." \
+  }
+  std::vector<std::string> feed_recipes;
+
+  #pragma cyclus var { \
+    "default": 0, \
+    "userlevel": 10, \
+    "tooltip": "feed pool assay width", \
+    "uilabel": "Feed Pool Width", \
+    "doc": "width in U-235 assay of the pools the feed inventory is kept " \
+           "in. Each trade draws from the cheapest pool that can cover it, " \
+           "or a blend of all pools if none can. Zero blends all feed " \
+           "into one pool." \
+  }
+  double feed_pool_width;
   
   #pragma cyclus var { \
     "tooltip": "product commodity",					\
@@ -303,6 +618,18 @@ class Enrichment : public cyclus::Facility {
     "doc": "tails assay from the enrichment process",       \
   }
   double tails_assay;
+
+  #pragma cyclus var { \
+    "default": 1e-4, \
+    "userlevel": 10, \
+    "tooltip": "tails assay bucket width", \
+    "uilabel": "Tails Assay Bucket Width", \
+    "doc": "tails are merged into one lot per bucket of this width in " \
+           "U-235 assay and offered as such. Zero keeps the tails of every " \
+           "enrichment as a separate lot, each bid on every tails request, " \
+           "so the number of bids grows with the tails inventory." \
+  }
+  double tails_bucket;
   
   #pragma cyclus var {							\
     "default": 0, "tooltip": "initial uranium reserves (kg)",		\
@@ -359,17 +686,157 @@ class Enrichment : public cyclus::Facility {
   }
   double swu_capacity;
 
+  #pragma cyclus var { \
+    "default": 0, \
+    "userlevel": 10, \
+    "tooltip": "number of cascade stages", \
+    "uilabel": "Cascade Stages", \
+    "doc": "number of stages in the enrichment cascade. If zero, the " \
+           "ideal cascade closed forms are used with the fixed tails " \
+           "assay. Otherwise each trade uses as many enriching stages as " \
+           "its product assay needs, and the remaining stripping stages " \
+           "bound how low its tails assay can go." \
+  }
+  int cascade_stages;
+
+  #pragma cyclus var { \
+    "default": 1.3, \
+    "userlevel": 10, \
+    "tooltip": "stage separation factor", \
+    "uilabel": "Stage Separation Factor", \
+    "doc": "ratio of the U-235/U-238 abundance ratio in the heads of a " \
+           "cascade stage to that in its tails. Only used if " \
+           "cascade_stages is non-zero." \
+  }
+  double stage_alpha;
+
+  #pragma cyclus var { \
+    "default": 0, \
+    "userlevel": 10, \
+    "tooltip": "SWU cost (per kgSWU)", \
+    "uilabel": "SWU Cost", \
+    "doc": "cost of a kg SWU. If this and feed_cost are both positive and " \
+           "cascade_stages is non-zero, the tails assay of each trade is " \
+           "chosen to minimize the total SWU and feed cost instead of " \
+           "using tails_assay." \
+  }
+  double swu_cost;
+
+  #pragma cyclus var { \
+    "default": 0, \
+    "userlevel": 10, \
+    "tooltip": "feed cost (per kg)", \
+    "uilabel": "Feed Cost", \
+    "doc": "cost of a kg of feed material, used with swu_cost to " \
+           "optimize tails assay in cascade mode" \
+  }
+  double feed_cost;
+
+  #pragma cyclus var { \
+    "default": 0, \
+    "userlevel": 10, \
+    "tooltip": "enrichment trace size", \
+    "uilabel": "Enrichment Trace Size", \
+    "doc": "number of most recent enrichments kept in an in-memory trace " \
+           "for debugging. Zero disables tracing." \
+  }
+  int trace_size;
+
+  #pragma cyclus var { \
+    "default": 0.045, \
+    "userlevel": 10, \
+    "tooltip": "assay for reported product capacity", \
+    "uilabel": "Capacity Assay", \
+    "doc": "product assay at which the SWU capacity is converted into a " \
+           "product commodity capacity reported to institutions" \
+  }
+  double capacity_assay;
+
+  #pragma cyclus var { \
+    "default": 12, \
+    "userlevel": 10, \
+    "tooltip": "headroom forecast window (time steps)", \
+    "uilabel": "Forecast Window", \
+    "doc": "number of past time steps of SWU and feed use that headroom " \
+           "forecasts are fit to" \
+  }
+  int forecast_window;
+
+  // U assay of feed_recipe, resolved by EnterNotify
+  double feed_recipe_assay_;
+
+  //// SWU used in each of the last forecast_window time steps, oldest first
+  #pragma cyclus var {"default": [], "internal": True}
+  std::list<double> swu_history;
+
+  //// feed used in each of the last forecast_window time steps, oldest first
+  #pragma cyclus var {"default": [], "internal": True}
+  std::list<double> feed_history;
+
+  #pragma cyclus var { \
+    "default": "trade", \
+    "userlevel": 10, \
+    "tooltip": "Enrichments table aggregation", \
+    "uilabel": "Enrichment Record Level", \
+    "doc": "how enrichments are aggregated in the Enrichments table: " \
+           "'trade' writes a row per trade, 'assay' a row per product " \
+           "assay per time step and 'step' a single row per time step. " \
+           "Rows are written at the end of each time step." \
+  }
+  std::string record_level;
+
+  // record_level, parsed by EnterNotify
+  enum RecordLevel { kTradeLevel, kAssayLevel, kStepLevel };
+  RecordLevel record_level_;
+
   double current_swu_capacity;
 
+  // ids of feed compositions already checked for non-U-235/238 content
+  std::unordered_set<int> checked_comps_;
+
+  // Enrichments table rows buffered until the end of the time step
+  std::vector<EnrichmentRecord> pending_records_;
+
+  // ring buffer of the last trace_size enrichments, trace_count_ in total
+  std::vector<EnrichmentTrace> trace_ring_;
+  long trace_count_;
+
+  // cascade model and its precomputed tails table, set up by EnterNotify
+  EnrichmentCascade cascade_;
+
   #pragma cyclus var { 'capacity': 'max_feed_inventory' }
   cyclus::toolkit::ResBuf<cyclus::Material> inventory;  // natural u
   #pragma cyclus var {}
   cyclus::toolkit::ResBuf<cyclus::Material> tails;  // depleted u
 
+  // tails_bucket key of each lot in tails, in buffer order. Tails are only
+  // popped from the front, so the keys of popped lots are dropped from the
+  // front by SyncTailsKeys_.
+  std::deque<double> tails_keys_;
+
   // used to total intra-timestep swu and natu usage for meeting requests -
   // these help enable time series generation.
   double intra_timestep_swu_;
   double intra_timestep_feed_;
+
+  // converter memo table, rebuilt every time step by GetMatlBids
+  EnrichmentMemo::Ptr conv_memo_;
+
+  // offer compositions by requested composition id, rebuilt every time step
+  // by GetMatlBids so that offers for the same recipe share a composition
+  // (and a conv_memo_ entry)
+  std::unordered_map<int, cyclus::Composition::Ptr> offer_comps_;
+
+  // AdjustMatlPrefs scratch space: U-235 mass fraction by composition id and
+  // the (fraction, bid) pairs of the request being sorted
+  std::unordered_map<int, double> u235_fracs_;
+  std::vector<std::pair<double, cyclus::Bid<cyclus::Material>*> > sorted_bids_;
+
+  // feed inventory pools, in the order their materials are held in
+  // inventory. Draws from a homogenous pool only change its quantity, so the
+  // pools are only rebuilt after feed is added.
+  std::vector<FeedPool> pools_;
+  bool pools_stale_;
   
   friend class EnrichmentTest;
   // ---
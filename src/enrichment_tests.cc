@@ -262,14 +262,16 @@ TEST_F(EnrichmentTest, TradeTails) {
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
   TEST_F(EnrichmentTest, TailsQty) {
   // this tests whether tails are being traded at correct quantity when
-  // requested amount is larger than qty in a single tails-buffer element
+  // requested amount is larger than qty in a single tails-buffer element,
+  // with tails merging turned off
 
   std::string config = 
     "   <feed_commod>natu</feed_commod> "
     "   <feed_recipe>natu1</feed_recipe> "
     "   <product_commod>enr_u</product_commod> "
     "   <tails_commod>tails</tails_commod> "
-    "   <tails_assay>0.003</tails_assay> ";
+    "   <tails_assay>0.003</tails_assay> "
+    "   <tails_bucket>0</tails_bucket> ";
 
   // time 1-source to EF, 2-Enrich, add to tails, 3-tails avail. for trade
   int simdur = 3;
@@ -314,6 +316,86 @@ TEST_F(EnrichmentTest, TradeTails) {
     "Not providing the requested quantity" ;
 }
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, TailsBucket) {
+  // by default, tails of the same assay bucket are merged into one lot as
+  // they are produced, and the merged lot is traded whole
+
+  std::string config =
+    "   <feed_commod>natu</feed_commod> "
+    "   <feed_recipe>natu1</feed_recipe> "
+    "   <product_commod>enr_u</product_commod> "
+    "   <tails_commod>tails</tails_commod> "
+    "   <tails_assay>0.003</tails_assay> ";
+
+  int simdur = 3;
+  cyclus::MockSim sim(cyclus::AgentSpec
+		      (":cycamore:Enrichment"), config, simdur);
+  sim.AddRecipe("natu1", c_natu1());
+  sim.AddRecipe("leu", c_leu());
+
+  sim.AddSource("natu")
+    .recipe("natu1")
+    .Finalize();
+  sim.AddSink("enr_u")
+    .recipe("leu")
+    .capacity(0.5)
+    .Finalize();
+  sim.AddSink("enr_u")
+    .recipe("leu")
+    .capacity(0.5)
+    .Finalize();
+  sim.AddSink("tails")
+    .Finalize();
+
+  int id = sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("Commodity", "==", std::string("tails")));
+  QueryResult qr = sim.db().Query("Transactions", &conds);
+  Material::Ptr m = sim.GetMaterial(qr.GetVal<int>("ResourceId"));
+
+  // The tails of both LEU sinks, 4.084kg each, share a bucket and are traded
+  // in one transaction.
+  EXPECT_EQ(1, qr.rows.size());
+  EXPECT_NEAR(8.168, m->quantity(), 0.01);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, RecordLevel) {
+  // two sinks enrich at the same time step, and are recorded as separate
+  // rows per trade or assay, or summed into one row per step
+  std::string levels[] = {"trade", "assay", "step"};
+  int nrows[] = {2, 1, 1};
+  for (int i = 0; i < 3; i++) {
+    std::string config =
+      "   <feed_commod>natu</feed_commod> "
+      "   <feed_recipe>natu1</feed_recipe> "
+      "   <product_commod>enr_u</product_commod> "
+      "   <tails_commod>tails</tails_commod> "
+      "   <tails_assay>0.003</tails_assay> "
+      "   <record_level>" + levels[i] + "</record_level> ";
+
+    int simdur = 2;
+    cyclus::MockSim sim(cyclus::AgentSpec
+                        (":cycamore:Enrichment"), config, simdur);
+    sim.AddRecipe("natu1", c_natu1());
+    sim.AddRecipe("leu", c_leu());
+    sim.AddSource("natu").recipe("natu1").Finalize();
+    sim.AddSink("enr_u").recipe("leu").capacity(0.5).Finalize();
+    sim.AddSink("enr_u").recipe("leu").capacity(0.5).Finalize();
+    int id = sim.Run();
+
+    QueryResult qr = sim.db().Query("Enrichments", NULL);
+    ASSERT_EQ(nrows[i], qr.rows.size()) << levels[i];
+    int trades = 0;
+    for (int j = 0; j < qr.rows.size(); j++) {
+      trades += qr.GetVal<int>("Trades", j);
+    }
+    EXPECT_EQ(2, trades) << levels[i];
+  }
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 TEST_F(EnrichmentTest, BidPrefs) {
   // This tests that natu sources are preference-ordered by
@@ -500,6 +582,40 @@ void EnrichmentTest::DoAddMat(cyclus::Material::Ptr mat) {
   src_facility->AddMat_(mat);
 }
 
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void EnrichmentTest::SetFeedPools(double width,
+                                  std::vector<std::string> commods) {
+  src_facility->feed_pool_width = width;
+  src_facility->feed_commods = commods;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void EnrichmentTest::DoTock(double swu, double feed) {
+  src_facility->intra_timestep_swu_ = swu;
+  src_facility->intra_timestep_feed_ = feed;
+  src_facility->Tock();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double EnrichmentTest::LastSwu() {
+  return src_facility->swu_history.back();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double EnrichmentTest::LastFeed() {
+  return src_facility->feed_history.back();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+void EnrichmentTest::SetTraceSize(int n) {
+  src_facility->trace_size = n;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+double EnrichmentTest::DoFeedAssay() {
+  return src_facility->FeedAssay();
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 cyclus::Material::Ptr EnrichmentTest::DoRequest() {
   return src_facility->Request_();
@@ -607,7 +723,301 @@ TEST_F(EnrichmentTest, ValidReq) {
   Material::Ptr offer = DoOffer(target);
 
   EXPECT_NEAR(swuc.convert(target), swuc.convert(offer), 0.001);
-  EXPECT_NEAR(natuc.convert(target) * mass_frac, natuc.convert(offer), 0.001); 
+  EXPECT_NEAR(natuc.convert(target) * mass_frac, natuc.convert(offer), 0.001);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, OfferSharesComposition) {
+  // offers for requests of the same recipe share one offer composition
+  using cyclus::CompMap;
+  using cyclus::Composition;
+  using cyclus::Material;
+
+  CompMap v;
+  v[922350000] = 0.05;
+  v[922380000] = 0.95;
+  Composition::Ptr c = Composition::CreateFromMass(v);
+  v[922350000] = 0.1;
+  v[922380000] = 0.9;
+  Composition::Ptr c2 = Composition::CreateFromMass(v);
+
+  Material::Ptr first = DoOffer(Material::CreateUntracked(1.0, c));
+  Material::Ptr second = DoOffer(Material::CreateUntracked(2.0, c));
+  Material::Ptr other = DoOffer(Material::CreateUntracked(1.0, c2));
+
+  EXPECT_EQ(first->comp(), second->comp());
+  EXPECT_DOUBLE_EQ(2.0, second->quantity());
+  EXPECT_NE(first->comp(), other->comp());
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, MemoConverters) {
+  // converters sharing a memo table must agree with the direct calculation,
+  // on first evaluation and on cache hits, across quantities and assays
+  using cyclus::CompMap;
+  using cyclus::Composition;
+  using cyclus::Material;
+
+  EnrichmentMemo::Ptr memo(new EnrichmentMemo());
+  SWUConverter swuc(feed_assay, tails_assay);
+  NatUConverter natuc(feed_assay, tails_assay);
+  SWUConverter swuc_memo(feed_assay, tails_assay, memo);
+  NatUConverter natuc_memo(feed_assay, tails_assay, memo);
+
+  double assays[] = {0.03, 0.05, 0.05, 0.2};
+  double qtys[] = {1, 5, 12.5, 0.1};
+  for (int i = 0; i < 4; i++) {
+    CompMap v;
+    v[922350000] = assays[i];
+    v[922380000] = 1 - assays[i];
+    v[942390000] = 0.1;
+    Material::Ptr m =
+        Material::CreateUntracked(qtys[i], Composition::CreateFromMass(v));
+    for (int j = 0; j < 2; j++) {
+      EXPECT_NEAR(swuc.convert(m), swuc_memo.convert(m), 1e-9);
+      EXPECT_NEAR(natuc.convert(m), natuc_memo.convert(m), 1e-9);
+    }
+  }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, Cascade) {
+  using cyclus::toolkit::Assays;
+  using cyclus::toolkit::FeedQty;
+  using cyclus::toolkit::SwuRequired;
+
+  EnrichmentCascade off;
+  EXPECT_FALSE(off.enabled());
+  EXPECT_THROW(off.Init(-1, 1.3, 0, 0), cyclus::ValueError);
+  EXPECT_THROW(off.Init(10, 1.0, 0, 0), cyclus::ValueError);
+
+  double feed = 0.0072;
+  double product = 0.045;
+
+  // without costs the configured tails are kept unless the stripping stages
+  // left over can't reach them
+  EnrichmentCascade fixed;
+  fixed.Init(40, 1.3, 0, 0);
+  int n_enr = fixed.EnrichingStages(feed, product);
+  EXPECT_GT(n_enr, 0);
+  EXPECT_TRUE(fixed.CanEnrich(feed, product));
+  EXPECT_DOUBLE_EQ(0.003, fixed.Tails(feed, product, 0.003));
+  double min_tails = fixed.Tails(feed, product, 0);
+  EXPECT_GT(min_tails, 0);
+  EXPECT_EQ(40 - n_enr, fixed.StrippingStages(feed, min_tails));
+
+  EnrichmentCascade short_cascade;
+  short_cascade.Init(n_enr, 1.3, 0, 0);
+  EXPECT_FALSE(short_cascade.CanEnrich(feed, product));
+
+  // with costs the tails minimize SWU plus feed cost, whatever the product
+  EnrichmentCascade priced;
+  priced.Init(1000, 1.3, 100, 50);
+  double opt = priced.Tails(feed, product, 0.003);
+  EXPECT_NEAR(opt, priced.Tails(feed, 0.2, 0.003), 1e-6);
+  EXPECT_GT(opt, 0);
+  EXPECT_LT(opt, feed);
+  Assays a_opt(feed, product, opt);
+  double best = 100 * SwuRequired(1, a_opt) + 50 * FeedQty(1, a_opt);
+  for (int i = -5; i <= 5; i++) {
+    Assays a(feed, product, opt * (1 + 0.02 * i));
+    double cost = 100 * SwuRequired(1, a) + 50 * FeedQty(1, a);
+    EXPECT_GE(cost, best - 1e-6);
+  }
+
+  // section SWU adds up to the closed form
+  Assays a(feed, product, opt);
+  std::pair<double, double> swu = priced.SectionSwu(10, a);
+  EXPECT_GT(swu.first, 0);
+  EXPECT_GT(swu.second, 0);
+  EXPECT_NEAR(SwuRequired(10, a), swu.first + swu.second, 1e-9);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, FeedAssay) {
+  // the cached feed assay must track the blend of everything added, and stay
+  // put as feed is drawn down
+  using cyclus::Material;
+  using cyclus::toolkit::UraniumAssay;
+
+  src_facility->SetMaxInventorySize(100);
+  EXPECT_DOUBLE_EQ(0, DoFeedAssay());
+
+  Material::Ptr nat = GetMat(10);
+  DoAddMat(nat);
+  EXPECT_NEAR(UraniumAssay(nat), DoFeedAssay(), 1e-12);
+
+  cyclus::CompMap v;
+  v[922350000] = 0.02;
+  v[922380000] = 0.98;
+  Material::Ptr enr = Material::CreateUntracked(
+      5, cyclus::Composition::CreateFromMass(v));
+  DoAddMat(enr);
+
+  Material::Ptr blend = GetMat(10);
+  blend->Absorb(Material::CreateUntracked(
+      5, cyclus::Composition::CreateFromMass(v)));
+  double expected = UraniumAssay(blend);
+  EXPECT_NEAR(expected, DoFeedAssay(), 1e-12);
+  EXPECT_NEAR(expected, DoFeedAssay(), 1e-12);
+
+  cyclus::CompMap p;
+  p[922350000] = 0.05;
+  p[922380000] = 0.95;
+  DoEnrich(Material::CreateUntracked(
+      0.5, cyclus::Composition::CreateFromMass(p)), 0.5);
+  EXPECT_NEAR(expected, DoFeedAssay(), 1e-12);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, CapacityForecast) {
+  using cyclus::toolkit::Assays;
+  using cyclus::toolkit::FeedQty;
+  using cyclus::toolkit::SwuRequired;
+
+  // the feed recipe is resolved on entry, before which there is no capacity
+  EXPECT_DOUBLE_EQ(0, src_facility->ProductCapacity(0.045));
+  src_facility->EnterNotify();
+
+  // capacity is the lesser of what SWU and a full feed inventory allow
+  Assays a(feed_assay, 0.045, tails_assay);
+  double by_swu = swu_capacity / SwuRequired(1, a);
+  double by_feed = inv_size / FeedQty(1, a);
+  EXPECT_NEAR(std::min(by_swu, by_feed), src_facility->ProductCapacity(0.045),
+              1e-3);
+  EXPECT_DOUBLE_EQ(0, src_facility->ProductCapacity(feed_assay / 2));
+
+  // use grows by 10 SWU per step
+  EXPECT_DOUBLE_EQ(0, src_facility->ForecastSwu(1));
+  for (int i = 1; i <= 3; i++) {
+    DoTock(10 * i, 50 * i);
+  }
+  EXPECT_NEAR(40, src_facility->ForecastSwu(1), 1e-9);
+  EXPECT_NEAR(200, src_facility->ForecastFeed(1), 1e-9);
+  EXPECT_NEAR(swu_capacity - 60, src_facility->SwuHeadroom(3), 1e-9);
+  EXPECT_NEAR(0.6, src_facility->SwuUtilization(3), 1e-9);
+  EXPECT_DOUBLE_EQ(0, src_facility->SwuHeadroom(100));
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, IdleStepHistory) {
+  // a time step without trades records no use after a busy one
+  src_facility->EnterNotify();
+  DoTock(10, 50);
+  EXPECT_DOUBLE_EQ(10, LastSwu());
+  EXPECT_DOUBLE_EQ(50, LastFeed());
+
+  src_facility->Tick();
+  src_facility->Tock();
+  EXPECT_DOUBLE_EQ(0, LastSwu());
+  EXPECT_DOUBLE_EQ(0, LastFeed());
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, EnterValidation) {
+  // a missing feed recipe or an empty forecast window fail on entry
+  std::string config =
+    "   <feed_commod>natu</feed_commod> "
+    "   <feed_recipe>natu1</feed_recipe> "
+    "   <product_commod>enr_u</product_commod> "
+    "   <tails_commod>tails</tails_commod> "
+    "   <tails_assay>0.003</tails_assay> ";
+
+  cyclus::MockSim no_recipe(cyclus::AgentSpec
+                            (":cycamore:Enrichment"), config, 1);
+  EXPECT_THROW(no_recipe.Run(), cyclus::ValidationError);
+
+  cyclus::MockSim no_window(cyclus::AgentSpec(":cycamore:Enrichment"),
+                            config +
+                            "   <forecast_window>0</forecast_window> ", 1);
+  no_window.AddRecipe("natu1", c_natu1());
+  EXPECT_THROW(no_window.Run(), cyclus::ValidationError);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, Trace) {
+  using cyclus::Material;
+
+  cyclus::CompMap v;
+  v[922350000] = 0.05;
+  v[922380000] = 0.95;
+  cyclus::Composition::Ptr leu = cyclus::Composition::CreateFromMass(v);
+  src_facility->SetMaxInventorySize(100);
+  DoAddMat(GetMat(100));
+
+  // tracing is off by default
+  DoEnrich(Material::CreateUntracked(0.1, leu), 0.1);
+  EXPECT_TRUE(src_facility->Trace().empty());
+
+  SetTraceSize(2);
+  for (int i = 1; i <= 3; i++) {
+    DoEnrich(Material::CreateUntracked(0.1 * i, leu), 0.1 * i);
+  }
+
+  std::vector<EnrichmentTrace> traces = src_facility->Trace();
+#if CYCAMORE_ENRICH_TRACE
+  ASSERT_EQ(2, traces.size());
+  EXPECT_DOUBLE_EQ(0.2, traces[0].product_qty);
+  EXPECT_DOUBLE_EQ(0.3, traces[1].product_qty);
+  EXPECT_NEAR(0.05, traces[1].product_assay, 1e-3);
+  EXPECT_DOUBLE_EQ(tails_assay, traces[1].tails_assay);
+  EXPECT_GT(traces[1].swu, traces[0].swu);
+
+  std::stringstream ss;
+  src_facility->DumpTrace(ss);
+  EXPECT_EQ(2 * (sizeof(int) + 8 * sizeof(double)), ss.str().size());
+  int time;
+  ss.read(reinterpret_cast<char*>(&time), sizeof(time));
+  EXPECT_EQ(traces[0].time, time);
+#else
+  EXPECT_TRUE(traces.empty());
+#endif
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+TEST_F(EnrichmentTest, FeedPools) {
+  // feed of distinct assays is kept in separate pools, each trade draws on the
+  // pool needing the least SWU, and trades no one pool can cover draw on a
+  // blend of all of them
+  using cyclus::Material;
+  using cyclus::RequestPortfolio;
+
+  std::vector<std::string> commods;
+  commods.push_back("rep_u");
+  SetFeedPools(1e-3, commods);
+  src_facility->SetMaxInventorySize(100);
+
+  std::set<RequestPortfolio<Material>::Ptr> ports =
+      src_facility->GetMatlRequests();
+  ASSERT_EQ(1, ports.size());
+  EXPECT_EQ(2, (*ports.begin())->requests().size());
+
+  cyclus::CompMap v;
+  v[922350000] = 0.01;
+  v[922380000] = 0.99;
+  cyclus::Composition::Ptr rep_u = cyclus::Composition::CreateFromMass(v);
+  DoAddMat(GetMat(10));
+  DoAddMat(Material::CreateUntracked(10, rep_u));
+  DoAddMat(GetMat(5));
+
+  double blend = DoFeedAssay();
+  EXPECT_GT(blend, feed_assay);
+  EXPECT_LT(blend, 0.0101);
+
+  cyclus::CompMap p;
+  p[922350000] = 0.05;
+  p[922380000] = 0.95;
+  cyclus::Composition::Ptr leu = cyclus::Composition::CreateFromMass(p);
+  DoEnrich(Material::CreateUntracked(0.2, leu), 0.2);
+  double drawn = DoFeedAssay();
+  EXPECT_LT(drawn, blend);
+
+  // too much for either pool alone, but drawing on a blend leaves the blend
+  // assay unchanged
+  Material::Ptr r;
+  EXPECT_NO_THROW(r = DoEnrich(Material::CreateUntracked(2, leu), 2));
+  EXPECT_DOUBLE_EQ(2, r->quantity());
+  EXPECT_NEAR(drawn, DoFeedAssay(), 1e-5);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -41,6 +41,12 @@ class EnrichmentTest : public ::testing::Test {
   cyclus::Material::Ptr DoBid(cyclus::Material::Ptr mat);
   cyclus::Material::Ptr DoOffer(cyclus::Material::Ptr mat);
   cyclus::Material::Ptr DoEnrich(cyclus::Material::Ptr mat, double qty);
+  double DoFeedAssay();
+  void SetTraceSize(int n);
+  void DoTock(double swu, double feed);
+  double LastSwu();
+  double LastFeed();
+  void SetFeedPools(double width, std::vector<std::string> commods);
   /// @param nreqs the total number of requests
   /// @param nvalid the number of requests that are valid
   boost::shared_ptr< cyclus::ExchangeContext<cyclus::Material> >
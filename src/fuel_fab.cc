@@ -4,6 +4,7 @@
 
 using cyclus::Material;
 using cyclus::Composition;
+using cyclus::toolkit::MatVec;
 using pyne::simple_xs;
 
 #define SHOW(X)                                                     \
@@ -130,8 +131,40 @@ class TopupConverter : public cyclus::Converter<cyclus::Material> {
   Composition::Ptr c_topup_;
 };
 
+// Restricts a capacity constraint to offers of a single ready fuel lot.
+class LotConverter : public cyclus::Converter<cyclus::Material> {
+ public:
+  LotConverter(int obj_id) : obj_id_(obj_id) {}
+
+  virtual ~LotConverter() {}
+
+  virtual double convert(
+      cyclus::Material::Ptr m, cyclus::Arc const* a = NULL,
+      cyclus::ExchangeTranslationContext<cyclus::Material> const* ctx =
+          NULL) const {
+    if (m->obj_id() == obj_id_) {
+      return m->quantity();
+    }
+    return 0;
+  }
+
+ private:
+  int obj_id_;
+};
+
+// Returns true if w1 and w2 are equivalent fuel weights to within mixing
+// precision.
+bool SameWeight(double w1, double w2) {
+  double scale = std::max(std::abs(w1), std::abs(w2));
+  return std::abs(w1 - w2) <= 1e-4 * std::max(scale, 1e-6);
+}
+
 FuelFab::FuelFab(cyclus::Context* ctx)
-    : cyclus::Facility(ctx), fill_size(0), fiss_size(0), throughput(0) {}
+    : cyclus::Facility(ctx),
+      fill_size(0),
+      fiss_size(0),
+      throughput(0),
+      fab_lead_time(0) {}
 
 void FuelFab::EnterNotify() {
   cyclus::Facility::EnterNotify();
@@ -159,6 +192,240 @@ void FuelFab::EnterNotify() {
   }
 }
 
+void FuelFab::Tick() {
+  if (fab_lead_time <= 0) {
+    return;
+  }
+
+  int t = context()->time();
+  fab_schedule.erase(fab_schedule.begin(), fab_schedule.lower_bound(t));
+
+  // fabrication is scheduled earliest first, so the fabbing buffer is in
+  // order of ready time
+  int n = 0;
+  std::map<int, int>::iterator end = fab_ready_counts.upper_bound(t);
+  std::map<int, int>::iterator it;
+  for (it = fab_ready_counts.begin(); it != end; ++it) {
+    n += it->second;
+  }
+  fab_ready_counts.erase(fab_ready_counts.begin(), end);
+
+  MatVec done = fabbing.PopN(n);
+  for (int i = 0; i < done.size(); i++) {
+    AddReady_(done[i]);
+  }
+}
+
+void FuelFab::Tock() {
+  if (fab_lead_time <= 0) {
+    return;
+  }
+
+  // orders are scheduled here rather than when bidding so that material
+  // received during this time step's exchange can be used.
+  for (int i = 0; i < orders_.size(); i++) {
+    ScheduleFab_(orders_[i].first, orders_[i].second);
+  }
+  orders_.clear();
+}
+
+void FuelFab::AddReady_(Material::Ptr m) {
+  double w = CosiWeight(m->comp(), spectrum);
+  MatVec lots = ready.PopN(ready.count());
+  bool merged = false;
+  for (int k = 0; k < lots.size(); k++) {
+    if (!merged && SameWeight(w, CosiWeight(lots[k]->comp(), spectrum))) {
+      lots[k]->Absorb(m);
+      merged = true;
+    }
+  }
+  ready.Push(lots);
+  if (!merged) {
+    ready.Push(m);
+  }
+}
+
+bool FuelFab::MixFracs_(double w_tgt, double* fiss_frac, double* fill_frac,
+                        double* topup_frac) {
+  *fiss_frac = 0;
+  *fill_frac = 0;
+  *topup_frac = 0;
+  if (fiss.count() == 0) {
+    return false;
+  }
+
+  Composition::Ptr c_fiss = fiss.Peek()->comp();
+  double w_fiss = CosiWeight(c_fiss, spectrum);
+  if (fill.count() > 0) {
+    Composition::Ptr c_fill = fill.Peek()->comp();
+    double w_fill = CosiWeight(c_fill, spectrum);
+    if (ValidWeights(w_fill, w_tgt, w_fiss)) {
+      *fiss_frac =
+          AtomToMassFrac(HighFrac(w_fill, w_tgt, w_fiss), c_fiss, c_fill);
+      *fill_frac =
+          AtomToMassFrac(LowFrac(w_fill, w_tgt, w_fiss), c_fill, c_fiss);
+      return true;
+    }
+  }
+  if (topup.count() > 0) {
+    Composition::Ptr c_topup = topup.Peek()->comp();
+    double w_topup = CosiWeight(c_topup, spectrum);
+    if (ValidWeights(w_fiss, w_tgt, w_topup)) {
+      *topup_frac =
+          AtomToMassFrac(HighFrac(w_fiss, w_tgt, w_topup), c_topup, c_fiss);
+      *fiss_frac =
+          AtomToMassFrac(LowFrac(w_fiss, w_tgt, w_topup), c_fiss, c_topup);
+      return true;
+    }
+  }
+  return false;
+}
+
+Material::Ptr FuelFab::PopMix_(double qty, double fiss_frac, double fill_frac,
+                               double topup_frac) {
+  // the std::min calls and zero fraction checks prevent ResBuf pop exceptions
+  MatVec mats;
+  if (fiss_frac > 0) {
+    double amt = std::min(fiss.quantity(), fiss_frac * qty);
+    mats.push_back(fiss.Pop(amt, cyclus::eps_rsrc()));
+  }
+  if (fill_frac > 0) {
+    double amt = std::min(fill.quantity(), fill_frac * qty);
+    mats.push_back(fill.Pop(amt, cyclus::eps_rsrc()));
+  }
+  if (topup_frac > 0) {
+    double amt = std::min(topup.quantity(), topup_frac * qty);
+    mats.push_back(topup.Pop(amt, cyclus::eps_rsrc()));
+  }
+  return cyclus::toolkit::Squash(mats);
+}
+
+void FuelFab::ScheduleFab_(Composition::Ptr tgt, double qty) {
+  if (throughput < cyclus::eps_rsrc()) {
+    return;
+  }
+
+  double fiss_frac, fill_frac, topup_frac;
+  if (!MixFracs_(CosiWeight(tgt, spectrum), &fiss_frac, &fill_frac,
+                 &topup_frac)) {
+    return;
+  }
+
+  // only schedule what can be made from the current inventories - the rest
+  // of the order is placed again if it is still requested next time step.
+  if (fiss_frac > 0) {
+    qty = std::min(qty, fiss.quantity() / fiss_frac);
+  }
+  if (fill_frac > 0) {
+    qty = std::min(qty, fill.quantity() / fill_frac);
+  }
+  if (topup_frac > 0) {
+    qty = std::min(qty, topup.quantity() / topup_frac);
+  }
+
+  int t = context()->time();
+  while (qty > cyclus::eps_rsrc()) {
+    double cap = throughput - fab_schedule[t];
+    if (cap > cyclus::eps_rsrc()) {
+      double amt = std::min(cap, qty);
+      fabbing.Push(PopMix_(amt, fiss_frac, fill_frac, topup_frac));
+      fab_ready_counts[t + fab_lead_time] += 1;
+      fab_schedule[t] += amt;
+      qty -= amt;
+
+      LOG(cyclus::LEV_INFO4, "FuelFab")
+          << prototype() << " scheduled fabrication of " << amt
+          << " kg of fuel at t=" << t << " ready at t=" << t + fab_lead_time;
+    }
+    t++;
+  }
+}
+
+std::set<cyclus::BidPortfolio<Material>::Ptr> FuelFab::BidReady_(
+    std::vector<cyclus::Request<Material>*>& reqs) {
+  using cyclus::BidPortfolio;
+
+  std::set<BidPortfolio<Material>::Ptr> ports;
+  orders_.clear();
+
+  MatVec lots = ready.PopN(ready.count());
+  ready.Push(lots);
+  std::vector<double> weights;
+  for (int k = 0; k < lots.size(); k++) {
+    weights.push_back(CosiWeight(lots[k]->comp(), spectrum));
+  }
+
+  // requested quantity by fuel weight - each class is represented by the
+  // first request of that weight
+  std::vector<double> class_weights;
+  std::vector<double> class_demand;
+  std::vector<Composition::Ptr> class_comps;
+
+  BidPortfolio<Material>::Ptr port(new BidPortfolio<Material>());
+  for (int j = 0; j < reqs.size(); j++) {
+    cyclus::Request<Material>* req = reqs[j];
+    double w_tgt = CosiWeight(req->target()->comp(), spectrum);
+    for (int k = 0; k < lots.size(); k++) {
+      if (SameWeight(weights[k], w_tgt)) {
+        port->AddBid(req, lots[k], this);
+      }
+    }
+
+    int c = 0;
+    while (c < class_weights.size() && !SameWeight(class_weights[c], w_tgt)) {
+      c++;
+    }
+    if (c == class_weights.size()) {
+      class_weights.push_back(w_tgt);
+      class_demand.push_back(0);
+      class_comps.push_back(req->target()->comp());
+    }
+    class_demand[c] += req->target()->quantity();
+  }
+
+  MatVec fab_lots = fabbing.PopN(fabbing.count());
+  fabbing.Push(fab_lots);
+  std::vector<double> fab_weights;
+  for (int k = 0; k < fab_lots.size(); k++) {
+    fab_weights.push_back(CosiWeight(fab_lots[k]->comp(), spectrum));
+  }
+
+  // Ready fuel bid now will be shipped, so only ready fuel beyond this time
+  // step's demand counts against it.  Fuel being fabricated does count -
+  // unfilled requests are placed again every time step until it is ready.
+  for (int c = 0; c < class_weights.size(); c++) {
+    double stock = 0;
+    for (int k = 0; k < lots.size(); k++) {
+      if (SameWeight(weights[k], class_weights[c])) {
+        stock += lots[k]->quantity();
+      }
+    }
+    double in_process = 0;
+    for (int k = 0; k < fab_lots.size(); k++) {
+      if (SameWeight(fab_weights[k], class_weights[c])) {
+        in_process += fab_lots[k]->quantity();
+      }
+    }
+    double surplus = std::max(0.0, stock - class_demand[c]);
+    double order = class_demand[c] - surplus - in_process;
+    if (order > cyclus::eps_rsrc()) {
+      orders_.push_back(std::make_pair(class_comps[c], order));
+    }
+  }
+
+  if (port->bids().size() == 0) {
+    return ports;
+  }
+
+  for (int k = 0; k < lots.size(); k++) {
+    cyclus::Converter<Material>::Ptr conv(new LotConverter(lots[k]->obj_id()));
+    cyclus::CapacityConstraint<Material> lotc(lots[k]->quantity(), conv);
+    port->AddConstraint(lotc);
+  }
+  ports.insert(port);
+  return ports;
+}
+
 std::set<cyclus::RequestPortfolio<Material>::Ptr> FuelFab::GetMatlRequests() {
   using cyclus::RequestPortfolio;
 
@@ -180,7 +447,7 @@ std::set<cyclus::RequestPortfolio<Material>::Ptr> FuelFab::GetMatlRequests() {
       std::string commod = fiss_commods[i];
       double pref = fiss_commod_prefs[i];
       reqs.push_back(port->AddRequest(m, this, commod, pref, exclusive));
-      req_inventories_[reqs.back()] = "fiss";
+      req_inventories_[reqs.back()] = &fiss;
     }
     port->AddMutualReqs(reqs);
     ports.insert(port);
@@ -200,7 +467,7 @@ std::set<cyclus::RequestPortfolio<Material>::Ptr> FuelFab::GetMatlRequests() {
       std::string commod = fill_commods[i];
       double pref = fill_commod_prefs[i];
       reqs.push_back(port->AddRequest(m, this, commod, pref, exclusive));
-      req_inventories_[reqs.back()] = "fill";
+      req_inventories_[reqs.back()] = &fill;
     }
     port->AddMutualReqs(reqs);
     ports.insert(port);
@@ -216,7 +483,7 @@ std::set<cyclus::RequestPortfolio<Material>::Ptr> FuelFab::GetMatlRequests() {
     }
     cyclus::Request<Material>* r =
         port->AddRequest(m, this, topup_commod, topup_pref, exclusive);
-    req_inventories_[r] = "topup";
+    req_inventories_[r] = &topup;
     ports.insert(port);
   }
 
@@ -239,19 +506,14 @@ void FuelFab::AcceptMatlTrades(
                         cyclus::Material::Ptr> >::const_iterator trade;
 
   for (trade = responses.begin(); trade != responses.end(); ++trade) {
-    std::string commod = trade->first.request->commodity();
-    double req_qty = trade->first.request->target()->quantity();
     cyclus::Request<Material>* req = trade->first.request;
-    Material::Ptr m = trade->second;
-    if (req_inventories_[req] == "fill") {
-      fill.Push(m);
-    } else if (req_inventories_[req] == "topup") {
-      topup.Push(m);
-    } else if (req_inventories_[req] == "fiss") {
-      fiss.Push(m);
-    } else {
+    std::unordered_map<cyclus::Request<Material>*,
+                       cyclus::toolkit::ResBuf<Material>*>::iterator it =
+        req_inventories_.find(req);
+    if (it == req_inventories_.end()) {
       throw cyclus::ValueError("cycamore::FuelFab was overmatched on requests");
     }
+    it->second->Push(trade->second);
   }
 
   req_inventories_.clear();
@@ -276,7 +538,9 @@ std::set<cyclus::BidPortfolio<Material>::Ptr> FuelFab::GetMatlBids(
   std::set<BidPortfolio<Material>::Ptr> ports;
   std::vector<cyclus::Request<Material>*>& reqs = commod_requests[outcommod];
 
-  if (throughput == 0) {
+  if (fab_lead_time > 0) {
+    return BidReady_(reqs);
+  } else if (throughput == 0) {
     return ports;
   } else if (reqs.size() == 0) {
     return ports;
@@ -390,6 +654,30 @@ void FuelFab::GetMatlTrades(
         responses) {
   using cyclus::Trade;
 
+  if (fab_lead_time > 0) {
+    // supply directly from the ready lots that were bid
+    MatVec lots = ready.PopN(ready.count());
+    for (int i = 0; i < trades.size(); i++) {
+      int obj_id = trades[i].bid->offer()->obj_id();
+      int k = 0;
+      while (k < lots.size() && lots[k]->obj_id() != obj_id) {
+        k++;
+      }
+      if (k == lots.size()) {
+        throw cyclus::ValueError("cycamore::FuelFab was matched on fuel "
+                                 "that is not in its ready inventory");
+      }
+      double amt = std::min(trades[i].amt, lots[k]->quantity());
+      responses.push_back(std::make_pair(trades[i], lots[k]->ExtractQty(amt)));
+    }
+    for (int k = 0; k < lots.size(); k++) {
+      if (lots[k]->quantity() > cyclus::eps_rsrc()) {
+        ready.Push(lots[k]);
+      }
+    }
+    return;
+  }
+
   // guard against cases where a buffer is empty - this is okay because some 
   // trades may not need that particular buffer.
   double w_fill = 0;
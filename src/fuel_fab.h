@@ -1,7 +1,9 @@
 #ifndef CYCAMORE_SRC_FUEL_FAB_H_
 #define CYCAMORE_SRC_FUEL_FAB_H_
 
+#include <map>
 #include <string>
+#include <unordered_map>
 #include "cyclus.h"
 #include "cycamore_version.h"
 
@@ -48,6 +50,14 @@ namespace cycamore {
 /// By default, the top-up inventory size is zero, and it is not used for
 /// mixing.
 ///
+/// Optionally, a fabrication lead time can be specified.  In this mode, fuel
+/// requests that can't be covered by already fabricated fuel are queued as
+/// fabrication orders.  Orders are scheduled against the per time step
+/// throughput of current and future time steps, and the fabricated fuel is
+/// held in a ready inventory once the lead time has elapsed.  Bids are only
+/// made from fuel in the ready inventory with the same weight as the
+/// requested material.
+///
 /// @code
 /// [1] Baker, A. R., and R. W. Ross. "Comparison of the value of plutonium and
 ///     uranium isotopes in fast reactors." Proceedings of the Conference on
@@ -98,6 +108,14 @@ class FuelFab : public cyclus::Facility {
   " By default, the top-up inventory size is zero, and it is not used for" \
   " mixing. " \
   "\n\n" \
+  "Optionally, a fabrication lead time can be specified.  In this mode, fuel" \
+  " requests that can't be covered by already fabricated fuel are queued as" \
+  " fabrication orders.  Orders are scheduled against the per time step" \
+  " throughput of current and future time steps, and the fabricated fuel is" \
+  " held in a ready inventory once the lead time has elapsed.  Bids are only" \
+  " made from fuel in the ready inventory with the same weight as the" \
+  " requested material." \
+  "\n\n" \
   "[1] Baker, A. R., and R. W. Ross. \"Comparison of the value of plutonium and" \
   "    uranium isotopes in fast reactors.\" Proceedings of the Conference on" \
   "    Breeding. Economics, and Safety in Large Fast Power Reactors. 1963." \
@@ -111,8 +129,8 @@ class FuelFab : public cyclus::Facility {
 
 #pragma cyclus
 
-  virtual void Tick(){};
-  virtual void Tock(){};
+  virtual void Tick();
+  virtual void Tock();
   virtual void EnterNotify();
 
   virtual std::set<cyclus::BidPortfolio<cyclus::Material>::Ptr> GetMatlBids(
@@ -130,6 +148,31 @@ class FuelFab : public cyclus::Facility {
   GetMatlRequests();
 
  private:
+  /// Computes the mass fractions of each input stream required to mix fuel
+  /// with weight w_tgt from the current inventories.  Returns false if the
+  /// inventories can't span the target weight.
+  bool MixFracs_(double w_tgt, double* fiss_frac, double* fill_frac,
+                 double* topup_frac);
+
+  /// Pops and combines the given mass fractions of qty kg from the fissile,
+  /// filler, and top-up inventories.
+  cyclus::Material::Ptr PopMix_(double qty, double fiss_frac,
+                                double fill_frac, double topup_frac);
+
+  /// Schedules fabrication of up to qty kg of fuel with the weight of tgt
+  /// against the remaining throughput of the current and future time steps.
+  void ScheduleFab_(cyclus::Composition::Ptr tgt, double qty);
+
+  /// Moves fabricated material into the ready inventory, combining it with
+  /// any ready fuel of the same weight.
+  void AddReady_(cyclus::Material::Ptr m);
+
+  /// Bids ready fuel on the given requests and queues fabrication orders for
+  /// this time step's requested quantity, less fuel of the same weight that
+  /// is already being fabricated or ready in excess of it.
+  std::set<cyclus::BidPortfolio<cyclus::Material>::Ptr> BidReady_(
+      std::vector<cyclus::Request<cyclus::Material>*>& reqs);
+
   #pragma cyclus var { \
     "doc": "Ordered list of commodities on which to requesting filler stream material.", \
     "uilabel": "Filler Stream Commodities", \
@@ -229,7 +272,9 @@ class FuelFab : public cyclus::Facility {
   std::string outcommod;
 
   #pragma cyclus var { \
-    "doc": "Maximum number of kg of fuel material that can be supplied per time step.", \
+    "doc": "Maximum number of kg of fuel material that can be supplied per time step." \
+           " If a fabrication lead time is used, this is instead the maximum" \
+           " number of kg of fuel that can be fabricated per time step.", \
     "uilabel": "Maximum Throughput", \
     "units": "kg", \
     "default": 1e299, \
@@ -246,9 +291,44 @@ class FuelFab : public cyclus::Facility {
   }
   std::string spectrum;
 
+  #pragma cyclus var { \
+    "default": 0, \
+    "doc": "Number of time steps between scheduling fabrication of fuel and" \
+           " that fuel becoming available for trading.  If greater than zero," \
+           " requests for fuel are queued as fabrication orders that are" \
+           " scheduled against the throughput of current and future time" \
+           " steps, and bids are made only from already fabricated fuel." \
+           " Zero results in fuel being mixed on demand when trades are" \
+           " matched.", \
+    "uilabel": "Fabrication Lead Time", \
+    "units": "time steps", \
+  }
+  int fab_lead_time;
+
+  #pragma cyclus var {"tooltip": "Buffer for fuel still being fabricated"}
+  cyclus::toolkit::ResBuf<cyclus::Material> fabbing;
+
+  //// number of lots in the fabbing buffer that become ready at each time
+  //// step, in the same order as the buffer
+  #pragma cyclus var {"default": {}, "internal": True}
+  std::map<int, int> fab_ready_counts;
+
+  #pragma cyclus var {"tooltip": "Buffer for fabricated fuel ready for trading"}
+  cyclus::toolkit::ResBuf<cyclus::Material> ready;
+
+  //// kg of fabrication throughput already committed for each time step
+  #pragma cyclus var {"default": {}, "internal": True}
+  std::map<int, double> fab_schedule;
+
+  // intra-time-step state - no need to be a state var
+  // requested fuel not covered by ready or in-process fuel
+  std::vector<std::pair<cyclus::Composition::Ptr, double> > orders_;
+
   // intra-time-step state - no need to be a state var
-  // map<request, inventory name>
-  std::map<cyclus::Request<cyclus::Material>*, std::string> req_inventories_;
+  // map<request, inventory the requested material is received into>
+  std::unordered_map<cyclus::Request<cyclus::Material>*,
+                     cyclus::toolkit::ResBuf<cyclus::Material>*>
+      req_inventories_;
 };
 
 double CosiWeight(cyclus::Composition::Ptr c, const std::string& spectrum);
@@ -890,6 +890,114 @@ TEST(FuelFabTests, HomogenousBuffers) {
   ASSERT_NO_THROW(sim.Run());
 }
 
+// with a fabrication lead time, fuel is first supplied once the order queued
+// on the first time step has been fabricated, after which steady demand is met
+// every time step.
+TEST(FuelFabTests, FabLeadTime) {
+  std::string config = 
+     "<fill_commods> <val>natu</val> </fill_commods>"
+     "<fill_recipe>natu</fill_recipe>"
+     "<fill_size>100</fill_size>"
+     ""
+     "<fiss_commods> <val>pustream</val> </fiss_commods>"
+     "<fiss_recipe>pustream</fiss_recipe>"
+     "<fiss_size>100</fiss_size>"
+     ""
+     "<outcommod>recyclefuel</outcommod>"
+     "<spectrum>thermal</spectrum>"
+     "<throughput>100</throughput>"
+     "<fab_lead_time>2</fab_lead_time>"
+     ;
+  int simdur = 5;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:FuelFab"), config, simdur);
+  sim.AddSource("pustream").Finalize();
+  sim.AddSource("natu").Finalize();
+  sim.AddSink("recyclefuel").recipe("uox").capacity(10).Finalize();
+  sim.AddRecipe("uox", c_uox());
+  sim.AddRecipe("pustream", c_pustream());
+  sim.AddRecipe("natu", c_natu());
+  int id = sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("Commodity", "==", std::string("recyclefuel")));
+  QueryResult qr = sim.db().Query("Transactions", &conds);
+  ASSERT_EQ(2, qr.rows.size());
+
+  double w_target = CosiWeight(c_uox(), "thermal");
+  for (int i = 0; i < qr.rows.size(); i++) {
+    EXPECT_EQ(2 + 2 * i, qr.GetVal<int>("Time", i));
+    Material::Ptr m = sim.GetMaterial(qr.GetVal<int>("ResourceId", i));
+    EXPECT_NEAR(10, m->quantity(), 1e-6);
+    double got = CosiWeight(m->comp(), "thermal");
+    EXPECT_LT(std::abs((w_target-got)/w_target), 0.00001) << "mixed composition not within 0.001% of target";
+  }
+
+  // the sink's request is covered by in-process fuel at t=1 and t=3, so 10 kg
+  // orders are placed at t=0, 2 and 4, and the filler used by the orders of
+  // t=0 and t=2 is replaced by t=1 and t=3 requests
+  double w_fill = CosiWeight(c_natu(), "thermal");
+  double w_fiss = CosiWeight(c_pustream(), "thermal");
+  double fill_frac = AtomToMassFrac(LowFrac(w_fill, w_target, w_fiss),
+                                    c_natu(), c_pustream());
+  cyclus::SqlStatement::Ptr stmt = sim.db().db().Prepare(
+      "SELECT SUM(r.Quantity) FROM Transactions AS t"
+      " INNER JOIN Resources AS r ON r.ResourceId = t.ResourceId"
+      " WHERE t.Commodity = 'natu' AND t.Time > 0;"
+      );
+  stmt->Step();
+  EXPECT_NEAR(2 * 10 * fill_frac, stmt->GetDouble(0), 1e-6);
+}
+
+// A sink re-requesting the same unfilled demand while it is being fabricated
+// gets exactly one batch fabricated for it.
+TEST(FuelFabTests, FabLeadTimeSingleBatch) {
+  std::string config = 
+     "<fill_commods> <val>natu</val> </fill_commods>"
+     "<fill_recipe>natu</fill_recipe>"
+     "<fill_size>100</fill_size>"
+     ""
+     "<fiss_commods> <val>pustream</val> </fiss_commods>"
+     "<fiss_recipe>pustream</fiss_recipe>"
+     "<fiss_size>100</fiss_size>"
+     ""
+     "<outcommod>recyclefuel</outcommod>"
+     "<spectrum>thermal</spectrum>"
+     "<throughput>100</throughput>"
+     "<fab_lead_time>2</fab_lead_time>"
+     ;
+  int simdur = 3;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:FuelFab"), config, simdur);
+  sim.AddSource("pustream").Finalize();
+  sim.AddSource("natu").Finalize();
+  sim.AddSink("recyclefuel").recipe("uox").capacity(10).Finalize();
+  sim.AddRecipe("uox", c_uox());
+  sim.AddRecipe("pustream", c_pustream());
+  sim.AddRecipe("natu", c_natu());
+  int id = sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("Commodity", "==", std::string("recyclefuel")));
+  QueryResult qr = sim.db().Query("Transactions", &conds);
+  ASSERT_EQ(1, qr.rows.size());
+  EXPECT_EQ(2, qr.GetVal<int>("Time", 0));
+  Material::Ptr m = sim.GetMaterial(qr.GetVal<int>("ResourceId", 0));
+  EXPECT_NEAR(10, m->quantity(), 1e-6);
+
+  // only the t=0 order consumed filler before the batch was shipped
+  double w_target = CosiWeight(c_uox(), "thermal");
+  double w_fill = CosiWeight(c_natu(), "thermal");
+  double w_fiss = CosiWeight(c_pustream(), "thermal");
+  double fill_frac = AtomToMassFrac(LowFrac(w_fill, w_target, w_fiss),
+                                    c_natu(), c_pustream());
+  cyclus::SqlStatement::Ptr stmt = sim.db().db().Prepare(
+      "SELECT SUM(r.Quantity) FROM Transactions AS t"
+      " INNER JOIN Resources AS r ON r.ResourceId = t.ResourceId"
+      " WHERE t.Commodity = 'natu' AND t.Time > 0;"
+      );
+  stmt->Step();
+  EXPECT_NEAR(10 * fill_frac, stmt->GetDouble(0), 1e-6);
+}
+
 } // namespace fuelfabtests
 } // namespace cycamore
 
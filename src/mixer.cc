@@ -1,6 +1,7 @@
 #include <sstream>
 
 #include "mixer.h"
+#include "snapshot_buf.h"
 
 namespace cycamore {
 
@@ -15,26 +16,33 @@ cyclus::Inventories Mixer::SnapshotInv() {
   // these inventory names are intentionally convoluted so as to not clash
   // with the user-specified stream commods that are used as the Mixer
   // streams inventory names.
-  invs["output-inv-name"] = output.PopNRes(output.count());
-  output.Push(invs["output-inv-name"]);
+  SnapshotBuf("output-inv-name", &output, &invs);
 
   std::map<std::string, cyclus::toolkit::ResBuf<cyclus::Material> >::iterator
       it;
   for (it = streambufs.begin(); it != streambufs.end(); ++it) {
-    invs[it->first] = it->second.PopNRes(it->second.count());
-    it->second.Push(invs[it->first]);
+    SnapshotBuf(it->first, &it->second, &invs);
   }
   return invs;
 }
 
 void Mixer::InitInv(cyclus::Inventories& inv) {
-  inv["output-inv-name"] = output.PopNRes(output.count());
   output.Push(inv["output-inv-name"]);
 
   cyclus::Inventories::iterator it;
   for (it = inv.begin(); it != inv.end(); ++it) {
-    streambufs[it->first].Push(it->second);
+    if (it->first != "output-inv-name") {
+      streambufs[it->first].Push(it->second);
+    }
+  }
+}
+
+cyclus::toolkit::ResBuf<cyclus::Material>& Mixer::InBuf_(int i) {
+  while (in_bufs_.size() <= i) {
+    std::string name = "in_stream_" + std::to_string(in_bufs_.size());
+    in_bufs_.push_back(&streambufs[name]);
   }
+  return *in_bufs_[i];
 }
 
 void Mixer::EnterNotify() {
@@ -94,9 +102,7 @@ void Mixer::Tick() {
     double tgt_qty = output.space();
 
     for (int i = 0; i < mixing_ratios.size(); i++) {
-      std::string name = "in_stream_" + std::to_string(i);
-      tgt_qty =
-          std::min(tgt_qty, streambufs[name].quantity() / mixing_ratios[i]);
+      tgt_qty = std::min(tgt_qty, InBuf_(i).quantity() / mixing_ratios[i]);
     }
 
     tgt_qty = std::min(tgt_qty, throughput);
@@ -104,13 +110,12 @@ void Mixer::Tick() {
     if (tgt_qty > 0) {
       cyclus::Material::Ptr m;
       for (int i = 0; i < mixing_ratios.size(); i++) {
-        std::string name = "in_stream_" + std::to_string(i);
         double pop_qty = mixing_ratios[i] * tgt_qty;
         if (i == 0) {
-          m = streambufs[name].Pop(pop_qty, cyclus::eps_rsrc());
+          m = InBuf_(i).Pop(pop_qty, cyclus::eps_rsrc());
         } else {
           cyclus::Material::Ptr m_ =
-              streambufs[name].Pop(pop_qty, cyclus::eps_rsrc());
+              InBuf_(i).Pop(pop_qty, cyclus::eps_rsrc());
           m->Absorb(m_);
         }
       }
@@ -126,14 +131,12 @@ Mixer::GetMatlRequests() {
   std::set<RequestPortfolio<cyclus::Material>::Ptr> ports;
   
   for (int i = 0; i < in_commods.size(); i++) {
-    std::string name = "in_stream_" + std::to_string(i);
-    
-    if (streambufs[name].space() > cyclus::eps_rsrc()) {
+    if (InBuf_(i).space() > cyclus::eps_rsrc()) {
       RequestPortfolio<cyclus::Material>::Ptr port(
           new RequestPortfolio<cyclus::Material>());
 
       cyclus::Material::Ptr m;
-      m = cyclus::NewBlankMaterial(streambufs[name].space());
+      m = cyclus::NewBlankMaterial(InBuf_(i).space());
 
       std::vector<cyclus::Request<cyclus::Material>*> reqs;
       
@@ -142,7 +145,7 @@ Mixer::GetMatlRequests() {
         std::string commod = it->first;
         double pref = it->second;
         reqs.push_back(port->AddRequest(m, this, commod , pref, false));
-        req_inventories_[reqs.back()] = name;
+        req_inventories_[reqs.back()] = i;
       }
       port->AddMutualReqs(reqs);  
       ports.insert(port);
@@ -159,23 +162,12 @@ void Mixer::AcceptMatlTrades(
 
   for (trade = responses.begin(); trade != responses.end(); ++trade) {
     cyclus::Request<cyclus::Material>* req = trade->first.request;
-    cyclus::Material::Ptr m = trade->second;
-
-    std::string name = req_inventories_[req];
-    bool assigned = false;
-    std::map<std::string, cyclus::toolkit::ResBuf<cyclus::Material> >::iterator
-        it;
-
-    for (it = streambufs.begin(); it != streambufs.end(); it++) {
-      if (name == it->first) {
-        it->second.Push(m);
-        assigned = true;
-        break;
-      }
-    }
-    if (!assigned) {
+    std::unordered_map<cyclus::Request<cyclus::Material>*, int>::iterator it =
+        req_inventories_.find(req);
+    if (it == req_inventories_.end()) {
       throw cyclus::ValueError("cycamore::Mixer was overmatched on requests");
     }
+    InBuf_(it->second).Push(trade->second);
   }
 
   req_inventories_.clear();
@@ -2,6 +2,7 @@
 #define CYCAMORE_SRC_MIXER_H_
 
 #include <string>
+#include <unordered_map>
 #include "cycamore_version.h"
 #include "cyclus.h"
 
@@ -56,6 +57,9 @@ class Mixer : public cyclus::Facility {
   virtual void InitInv(cyclus::Inventories& inv);
 
  protected:
+  /// Returns the input buffer for the i-th stream.
+  cyclus::toolkit::ResBuf<cyclus::Material>& InBuf_(int i);
+
 #pragma cyclus var { \
     "alias": ["in_streams", [ "stream", [ "info", "mixing_ratio", "buf_size"], [ "commodities", "commodity", "pref"]]], \
     "uitype": ["oneormore", [ "pair", ["pair", "double", "double"], ["oneormore", "incommodity", "double"]]], \
@@ -72,6 +76,10 @@ class Mixer : public cyclus::Facility {
   // state var.
   std::map<std::string, cyclus::toolkit::ResBuf<cyclus::Material> > streambufs;
 
+  // input stream buffers indexed by stream number - populated lazily by
+  // InBuf_ and pointing into streambufs.
+  std::vector<cyclus::toolkit::ResBuf<cyclus::Material>*> in_bufs_;
+
 
 #pragma cyclus var {                                                 \
   "doc" : "Commodity on which to offer/supply mixed fuel material.", \
@@ -104,8 +112,8 @@ class Mixer : public cyclus::Facility {
   double throughput;
 
   // intra-time-step state - no need to be a state var
-  // map<request, inventory name>
-  std::map<cyclus::Request<cyclus::Material>*, std::string> req_inventories_;
+  // map<request, input stream index>
+  std::unordered_map<cyclus::Request<cyclus::Material>*, int> req_inventories_;
 
   //// A policy for sending material
   cyclus::toolkit::MatlSellPolicy sell_policy;
@@ -459,4 +459,33 @@ TEST(MixerTests, CompleteMixingProcess) {
   EXPECT_DOUBLE_EQ(1., m->quantity());
 }
 
+// Inventories snapshotted by SnapshotInv are restored to the same buffers by
+// InitInv.
+TEST_F(MixerTest, SnapshotInvRoundTrip) {
+  using cyclus::Material;
+
+  SetOutStream_capacity(50);
+  SetThroughput(1e200);
+  mf_facility_->EnterNotify();
+
+  std::vector<Material::Ptr> mat;
+  mat.push_back(Material::CreateUntracked(10, c_natu()));
+  SetInputInv(mat);
+  GetOutPutBuffer()->Push(Material::CreateUntracked(5, c_uox()));
+
+  cyclus::Inventories invs = mf_facility_->SnapshotInv();
+  EXPECT_EQ(2, invs.size());
+  EXPECT_DOUBLE_EQ(5, GetOutPutBuffer()->quantity());
+
+  Mixer* restored = new Mixer(tc_.get());
+  restored->InitInv(invs);
+  delete mf_facility_;
+  mf_facility_ = restored;
+
+  EXPECT_DOUBLE_EQ(5, GetOutPutBuffer()->quantity());
+  std::map<std::string, InvBuffer> bufs = GetStreamBuffer();
+  EXPECT_EQ(1, bufs.size());
+  EXPECT_DOUBLE_EQ(10, bufs["in_stream_0"].quantity());
+}
+
 }  // namespace cycamore
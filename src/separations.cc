@@ -1,5 +1,9 @@
 #include "separations.h"
 
+#include <algorithm>
+
+#include "snapshot_buf.h"
+
 using cyclus::Material;
 using cyclus::Composition;
 using cyclus::toolkit::ResBuf;
@@ -11,7 +15,11 @@ using cyclus::CompMap;
 
 namespace cycamore {
 
-Separations::Separations(cyclus::Context* ctx) : cyclus::Facility(ctx) {}
+Separations::Separations(cyclus::Context* ctx)
+    : cyclus::Facility(ctx),
+      feed_order_(kBatchOrder),
+      leftover_held_(0),
+      pipeline_qty_(0) {}
 
 cyclus::Inventories Separations::SnapshotInv() {
   cyclus::Inventories invs;
@@ -19,15 +27,30 @@ cyclus::Inventories Separations::SnapshotInv() {
   // these inventory names are intentionally convoluted so as to not clash
   // with the user-specified stream commods that are used as the separations
   // streams inventory names.
-  invs["leftover-inv-name"] = leftover.PopNRes(leftover.count());
-  leftover.Push(invs["leftover-inv-name"]);
-  invs["feed-inv-name"] = feed.PopNRes(feed.count());
-  feed.Push(invs["feed-inv-name"]);
+  SnapshotBuf("leftover-inv-name", &leftover, &invs);
+  SnapshotBuf("feed-inv-name", &feed, &invs);
 
   std::map<std::string, ResBuf<Material> >::iterator it;
   for (it = streambufs.begin(); it != streambufs.end(); ++it) {
-    invs[it->first] = it->second.PopNRes(it->second.count());
-    it->second.Push(invs[it->first]);
+    SnapshotBuf(it->first, &it->second, &invs);
+  }
+
+  // in-process lots are keyed by their stage and the time step they finish
+  // it, with -1 for lots already waiting on the next stage
+  for (int i = 0; i < calendar_.size(); i++) {
+    for (int j = 0; j < calendar_[i].size(); j++) {
+      const PipeLot& lot = calendar_[i][j];
+      std::stringstream key;
+      key << "pipeline-inv-name:" << lot.stage << ":" << lot.ready;
+      invs[key.str()].push_back(lot.mat);
+    }
+  }
+  for (int i = 0; i < waiting_.size(); i++) {
+    std::stringstream key;
+    key << "pipeline-inv-name:" << i << ":-1";
+    for (int j = 0; j < waiting_[i].size(); j++) {
+      invs[key.str()].push_back(waiting_[i][j]);
+    }
   }
 
   return invs;
@@ -39,6 +62,19 @@ void Separations::InitInv(cyclus::Inventories& inv) {
 
   cyclus::Inventories::iterator it;
   for (it = inv.begin(); it != inv.end(); ++it) {
+    if (it->first == "leftover-inv-name" || it->first == "feed-inv-name") {
+      continue;
+    } else if (it->first.compare(0, 18, "pipeline-inv-name:") == 0) {
+      int stage;
+      int ready;
+      char sep;
+      std::stringstream key(it->first.substr(18));
+      key >> stage >> sep >> ready;
+      for (int i = 0; i < it->second.size(); i++) {
+        RestoreLot_(stage, ready, cyclus::ResCast<Material>(it->second[i]));
+      }
+      continue;
+    }
     streambufs[it->first].Push(it->second);
   }
 }
@@ -48,11 +84,13 @@ typedef std::map<std::string, Stream> StreamSet;
 
 void Separations::EnterNotify() {
   cyclus::Facility::EnterNotify();
-  std::map<int, double> efficiency_;
 
   StreamSet::iterator it;
   std::map<int, double>::iterator it2;
 
+  stream_names_.clear();
+  stream_bufs_.clear();
+  std::vector<std::map<int, double> > stream_effs;
   for (it = streams_.begin(); it != streams_.end(); ++it) {
     std::string name = it->first;
     Stream stream = it->second;
@@ -60,19 +98,61 @@ void Separations::EnterNotify() {
     if (cap >= 0) {
       streambufs[name].capacity(cap);
     }
+    stream_names_.push_back(name);
+    stream_bufs_.push_back(&streambufs[name]);
+    stream_effs.push_back(stream.second);
 
     for (it2 = stream.second.begin(); it2 != stream.second.end(); it2++) {
-      efficiency_[it2->first] += it2->second;
+      if (it2->second < 0) {
+        std::stringstream ss;
+        ss << "In " << prototype() << ", stream " << name
+           << " has a negative separation efficiency for " << it2->first;
+        throw cyclus::ValueError(ss.str());
+      }
     }
   }
-
-  std::vector<int> eff_pb_;
-  for (it2 = efficiency_.begin(); it2 != efficiency_.end(); it2++) {
-    if (it2->second > 1) {
-      eff_pb_.push_back(it2->first);
+  sep_matrix_.Compile(stream_effs);
+  sep_cache_.clear();
+
+  int nstreams = stream_names_.size();
+  stream_rates_.assign(nstreams, 1e299);
+  stream_spill_.assign(nstreams, false);
+  stream_out_.assign(nstreams, 0);
+  throttled_.assign(nstreams, 0);
+  spilled_.assign(nstreams, 0);
+  std::map<std::string, double>::iterator rit;
+  for (rit = stream_rate_limits.begin(); rit != stream_rate_limits.end();
+       ++rit) {
+    int i = std::find(stream_names_.begin(), stream_names_.end(), rit->first) -
+            stream_names_.begin();
+    if (i == nstreams) {
+      throw ValueError("In " + prototype() + ", stream_rate_limits names "
+                       "unknown stream " + rit->first);
+    } else if (rit->second < 0) {
+      throw ValueError("In " + prototype() + ", stream_rate_limits must not "
+                       "be negative");
     }
+    stream_rates_[i] = rit->second;
+  }
+  for (int j = 0; j < spill_streams.size(); j++) {
+    int i = std::find(stream_names_.begin(), stream_names_.end(),
+                      spill_streams[j]) - stream_names_.begin();
+    if (i == nstreams) {
+      throw ValueError("In " + prototype() + ", spill_streams names unknown "
+                       "stream " + spill_streams[j]);
+    }
+    stream_spill_[i] = true;
+  }
+  feed_sep_fracs_.clear();
+  if (!feed_recipe.empty()) {
+    Composition::Ptr c = context()->GetRecipe(feed_recipe);
+    sep_matrix_.Expand(c->mass());
+    std::vector<Composition::Ptr> sepcomps;
+    Separate_(Material::CreateUntracked(1, c), &sepcomps, &feed_sep_fracs_);
   }
 
+  std::vector<int> eff_pb_ = sep_matrix_.Overallocated();
+
   if (eff_pb_.size() > 0) {
     std::stringstream ss;
     ss << "In " << prototype() << ", ";
@@ -90,62 +170,432 @@ void Separations::EnterNotify() {
     throw cyclus::ValueError(ss.str());
   }
 
+  if (feed_order == "batch") {
+    feed_order_ = kBatchOrder;
+  } else if (feed_order == "fifo") {
+    feed_order_ = kFifoOrder;
+  } else if (feed_order == "priority") {
+    feed_order_ = kPriorityOrder;
+  } else {
+    throw ValueError("In " + prototype() + ", feed_order must be one of "
+                     "'batch', 'fifo' or 'priority', not '" + feed_order +
+                     "'");
+  }
+
   if (feed_commod_prefs.size() == 0) {
     for (int i = 0; i < feed_commods.size(); i++) {
       feed_commod_prefs.push_back(cyclus::kDefaultPref);
     }
   }
+
+  for (int i = 0; i < stage_durations.size(); i++) {
+    if (stage_durations[i] < 0) {
+      throw ValueError("In " + prototype() +
+                       ", stage_durations must not be negative");
+    }
+  }
+  if (stage_capacities.size() > stage_durations.size()) {
+    throw ValueError("In " + prototype() + ", stage_capacities must not have "
+                     "more entries than stage_durations");
+  }
+  for (int i = 0; i < stage_capacities.size(); i++) {
+    if (stage_capacities[i] < 0) {
+      throw ValueError("In " + prototype() +
+                       ", stage_capacities must not be negative");
+    }
+  }
+  SizePipeline_();
+}
+
+void Separations::SizePipeline_() {
+  int nstages = stage_durations.size();
+  int ringsize = nstages > 0 ? 1 : 0;
+  for (int i = 0; i < nstages; i++) {
+    ringsize = std::max(ringsize, stage_durations[i] + 1);
+  }
+
+  // lots restored by InitInv are kept
+  if (calendar_.size() != ringsize) {
+    calendar_.assign(ringsize, std::vector<PipeLot>());
+  }
+  if (waiting_.size() != nstages) {
+    waiting_.assign(nstages, std::deque<Material::Ptr>());
+  }
+  stage_room_.assign(nstages, 0);
+}
+
+void Separations::RestoreLot_(int stage, int ready, Material::Ptr mat) {
+  SizePipeline_();
+  pipeline_qty_ += mat->quantity();
+  if (ready < 0 || ready <= context()->time()) {
+    waiting_[stage].push_back(mat);
+    return;
+  }
+  PipeLot lot;
+  lot.mat = mat;
+  lot.stage = stage;
+  lot.ready = ready;
+  calendar_[ready % calendar_.size()].push_back(lot);
 }
 
 void Separations::Tick() {
-  if (feed.count() == 0) {
+  stream_out_.assign(stream_names_.size(), 0);
+  if (!stage_durations.empty()) {
+    StartPipelineStep_();
+  }
+
+  if (feed.count() > 0 && feed_order_ != kBatchOrder) {
+    ProcessLots_();
+  } else if (feed.count() > 0 && IntakeCapacity_() > 0) {
+    double pop_qty = std::min(IntakeCapacity_(), feed.quantity());
+    Material::Ptr mat = feed.Pop(pop_qty, cyclus::eps_rsrc());
+    Material::Ptr rem = Intake_(mat);
+    if (rem) {
+      // push back any leftover feed due to separated stream inv size
+      // constraints
+      feed.Push(rem);
+    }
+  }
+
+  if (!stage_durations.empty()) {
+    AdvancePipeline_();
+  }
+}
+
+double Separations::IntakeCapacity_() {
+  if (stage_durations.empty()) {
+    return throughput;
+  }
+  // feed is only separated once it leaves the last stage, so don't take in
+  // more than the stream buffers will have room for
+  return std::min(throughput, std::min(stage_room_[0], StreamRoom_()));
+}
+
+double Separations::StreamRoom_() {
+  if (feed_sep_fracs_.empty()) {
+    return 1e299;
+  }
+
+  double room = 1e299;
+  double leftover_frac = 1;
+  for (int i = 0; i < feed_sep_fracs_.size(); i++) {
+    if (feed_sep_fracs_[i] > 0 && !stream_spill_[i]) {
+      room = std::min(room, stream_bufs_[i]->space() / feed_sep_fracs_[i]);
+    }
+    leftover_frac -= feed_sep_fracs_[i];
+  }
+  if (leftover_frac > cyclus::eps()) {
+    room = std::min(room, leftover.space() / leftover_frac);
+  }
+  return std::max(0.0, room - pipeline_qty_);
+}
+
+double Separations::ProcessRate_() {
+  double rate = throughput;
+  for (int i = 0; i < feed_sep_fracs_.size(); i++) {
+    if (feed_sep_fracs_[i] > 0 && !stream_spill_[i]) {
+      rate = std::min(rate, stream_rates_[i] / feed_sep_fracs_[i]);
+    }
+  }
+  return rate;
+}
+
+Material::Ptr Separations::Intake_(Material::Ptr mat) {
+  if (stage_durations.empty()) {
+    return Process_(mat);
+  }
+  EnterStage_(0, mat);
+  return Material::Ptr();
+}
+
+void Separations::EnterStage_(int stage, Material::Ptr mat) {
+  stage_room_[stage] -= mat->quantity();
+  if (stage == 0) {
+    pipeline_qty_ += mat->quantity();
+  }
+  int dur = stage_durations[stage];
+  if (dur == 0) {
+    waiting_[stage].push_back(mat);
     return;
   }
-  double pop_qty = std::min(throughput, feed.quantity());
-  Material::Ptr mat = feed.Pop(pop_qty, cyclus::eps_rsrc());
+  PipeLot lot;
+  lot.mat = mat;
+  lot.stage = stage;
+  lot.ready = context()->time() + dur;
+  calendar_[lot.ready % calendar_.size()].push_back(lot);
+}
+
+void Separations::StartPipelineStep_() {
+  std::vector<PipeLot>& due = calendar_[context()->time() % calendar_.size()];
+  for (int i = 0; i < due.size(); i++) {
+    waiting_[due[i].stage].push_back(due[i].mat);
+  }
+  due.clear();
+
+  for (int i = 0; i < stage_room_.size(); i++) {
+    stage_room_[i] = i < stage_capacities.size() ? stage_capacities[i] : 1e299;
+  }
+}
+
+void Separations::AdvancePipeline_() {
+  int last = waiting_.size() - 1;
+  for (int i = 0; i <= last; i++) {
+    std::deque<Material::Ptr>& q = waiting_[i];
+    while (!q.empty()) {
+      Material::Ptr m = q.front();
+      if (i == last) {
+        pipeline_qty_ -= m->quantity();
+        Material::Ptr rem = Process_(m);
+        if (rem) {
+          pipeline_qty_ += rem->quantity();
+          // stream buffers are full
+          q.front() = rem;
+          break;
+        }
+        q.pop_front();
+        continue;
+      }
+
+      double room = stage_room_[i + 1];
+      if (room < cyclus::eps_rsrc()) {
+        break;
+      } else if (m->quantity() > room) {
+        EnterStage_(i + 1, m->ExtractQty(room));
+        break;
+      }
+      q.pop_front();
+      EnterStage_(i + 1, m);
+    }
+  }
+}
+
+Material::Ptr Separations::Process_(Material::Ptr mat) {
   double orig_qty = mat->quantity();
 
-  StreamSet::iterator it;
+  std::vector<Composition::Ptr> sepcomps;
+  std::vector<double> sepqtys;
+  Separate_(mat, &sepcomps, &sepqtys);
+
+  // the fraction of mat that fits in every stream that doesn't spill - a min
+  // reduction in fixed stream order, so the result doesn't depend on how it
+  // is evaluated
+  int n = stream_bufs_.size();
+  std::vector<double> room(n);
   double maxfrac = 1;
-  std::map<std::string, Material::Ptr> stagedsep;
-  for (it = streams_.begin(); it != streams_.end(); ++it) {
-    Stream info = it->second;
-    std::string name = it->first;
-    stagedsep[name] = SepMaterial(info.second, mat);
-    double frac = streambufs[name].space() / stagedsep[name]->quantity();
-    if (frac < maxfrac) {
-      maxfrac = frac;
+  int limiting = -1;
+  for (int i = 0; i < n; i++) {
+    room[i] = std::max(0.0, std::min(stream_bufs_[i]->space(),
+                                     stream_rates_[i] - stream_out_[i]));
+    if (sepqtys[i] > 0 && !stream_spill_[i] && room[i] / sepqtys[i] < maxfrac) {
+      maxfrac = room[i] / sepqtys[i];
+      limiting = i;
+    }
+  }
+
+  // leftovers take the unseparated material and whatever spills, so they
+  // can hold processing back too
+  double leftfrac = LeftoverLimit_(orig_qty, sepqtys, room, maxfrac);
+  if (leftfrac < maxfrac) {
+    maxfrac = leftfrac;
+    leftover_held_ += (1 - maxfrac) * orig_qty;
+  } else if (limiting >= 0) {
+    throttled_[limiting] += (1 - maxfrac) * orig_qty;
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (sepqtys[i] <= 0) {
+      continue;
+    }
+    double qty = sepqtys[i] * maxfrac;
+    if (stream_spill_[i] && qty > room[i]) {
+      // the excess stays in mat and goes to leftovers
+      spilled_[i] += qty - room[i];
+      qty = room[i];
+      if (qty <= 0) {
+        continue;
+      }
+    }
+    stream_out_[i] += qty;
+    stream_bufs_[i]->Push(mat->ExtractComp(qty, sepcomps[i]));
+  }
+
+  Material::Ptr rem;
+  if (maxfrac < 1) {
+    rem = mat->ExtractQty((1 - maxfrac) * orig_qty);
+  }
+  if (mat->quantity() > 0) {
+    // unspecified separations fractions go to leftovers
+    leftover.Push(mat);
+  }
+  return rem;
+}
+
+double Separations::LeftoverQty_(double frac, double qty,
+                                 const std::vector<double>& sepqtys,
+                                 const std::vector<double>& room) {
+  double unsep = qty;
+  double spill = 0;
+  for (int i = 0; i < sepqtys.size(); i++) {
+    unsep -= sepqtys[i];
+    if (stream_spill_[i]) {
+      spill += std::max(0.0, frac * sepqtys[i] - room[i]);
+    }
+  }
+  return frac * std::max(0.0, unsep) + spill;
+}
+
+double Separations::LeftoverLimit_(double qty,
+                                   const std::vector<double>& sepqtys,
+                                   const std::vector<double>& room,
+                                   double maxfrac) {
+  // the leftover quantity is piecewise linear and increasing in the fraction
+  // processed, with a kink where each spilling stream starts to overflow, so
+  // walk the kinks up to maxfrac and interpolate in the segment that fills
+  // the leftover buffer
+  std::vector<double> kinks(1, maxfrac);
+  for (int i = 0; i < sepqtys.size(); i++) {
+    if (stream_spill_[i] && sepqtys[i] > 0 && room[i] / sepqtys[i] < maxfrac) {
+      kinks.push_back(room[i] / sepqtys[i]);
+    }
+  }
+  std::sort(kinks.begin(), kinks.end());
+
+  double space = leftover.space();
+  double f0 = 0;
+  double q0 = 0;
+  for (int i = 0; i < kinks.size(); i++) {
+    double q = LeftoverQty_(kinks[i], qty, sepqtys, room);
+    if (q > space) {
+      return f0 + (kinks[i] - f0) * (space - q0) / (q - q0);
+    }
+    f0 = kinks[i];
+    q0 = q;
+  }
+  return maxfrac;
+}
+
+namespace {
+
+struct PrefGreater {
+  bool operator()(const std::pair<double, Material::Ptr>& a,
+                  const std::pair<double, Material::Ptr>& b) const {
+    return a.first > b.first;
+  }
+};
+
+}  // namespace
+
+void Separations::ProcessLots_() {
+  // all lots are popped so unprocessed ones can be pushed back in order
+  MatVec popped = feed.PopN(feed.count());
+  std::vector<std::pair<double, Material::Ptr> > lots;
+  for (int i = 0; i < popped.size(); i++) {
+    std::map<int, double>::iterator it = lot_prefs.find(popped[i]->obj_id());
+    double pref = it != lot_prefs.end() ? it->second : cyclus::kDefaultPref;
+    lots.push_back(std::make_pair(pref, popped[i]));
+  }
+  if (feed_order_ == kPriorityOrder) {
+    std::stable_sort(lots.begin(), lots.end(), PrefGreater());
+  }
+
+  double budget = IntakeCapacity_();
+  std::vector<std::pair<double, Material::Ptr> > unprocessed;
+  int i = 0;
+  while (i < lots.size() && budget > cyclus::eps_rsrc()) {
+    // take lot i, along with any following lots of identical composition
+    double pref = lots[i].first;
+    Material::Ptr batch;
+    while (i < lots.size() && budget > cyclus::eps_rsrc() &&
+           (!batch || lots[i].second->comp() == batch->comp())) {
+      Material::Ptr lot = lots[i].second;
+      double qty = std::min(budget, lot->quantity());
+      RecordLot_(lot, qty);
+      Material::Ptr m = lot;
+      if (qty < lot->quantity()) {
+        m = lot->ExtractQty(qty);
+      } else {
+        lot_prefs.erase(lot->obj_id());
+        i++;
+      }
+      budget -= qty;
+      if (!batch) {
+        batch = m;
+      } else {
+        batch->Absorb(m);
+      }
+    }
+
+    Material::Ptr rem = Intake_(batch);
+    if (rem) {
+      // stream buffers are full - stop here and keep the rest in order
+      unprocessed.push_back(std::make_pair(pref, rem));
+      break;
     }
   }
+  unprocessed.insert(unprocessed.end(), lots.begin() + i, lots.end());
 
-  std::map<std::string, Material::Ptr>::iterator itf;
-  for (itf = stagedsep.begin(); itf != stagedsep.end(); ++itf) {
-    std::string name = itf->first;
-    Material::Ptr m = itf->second;
-    if (m->quantity() > 0) {
-      streambufs[name].Push(
-          mat->ExtractComp(m->quantity() * maxfrac, m->comp()));
+  for (int j = 0; j < unprocessed.size(); j++) {
+    Material::Ptr m = unprocessed[j].second;
+    if (m->quantity() > cyclus::eps_rsrc()) {
+      lot_prefs[m->obj_id()] = unprocessed[j].first;
+      feed.Push(m);
     }
   }
+}
+
+void Separations::RecordLot_(Material::Ptr lot, double qty) {
+  context()
+      ->NewDatum("SeparationsLots")
+      ->AddVal("AgentId", id())
+      ->AddVal("Time", context()->time())
+      ->AddVal("ResourceId", lot->state_id())
+      ->AddVal("ObjId", lot->obj_id())
+      ->AddVal("QualId", lot->qual_id())
+      ->AddVal("Quantity", qty)
+      ->Record();
+}
 
-  if (maxfrac == 1) {
-    if (mat->quantity() > 0) {
-      // unspecified separations fractions go to leftovers
-      leftover.Push(mat);
+void Separations::Separate_(Material::Ptr mat,
+                            std::vector<Composition::Ptr>* comps,
+                            std::vector<double>* qtys) {
+  // bound the cache for facilities fed an ever-changing stream of mixtures
+  static const int kMaxCachedComps = 100;
+
+  int id = mat->comp()->id();
+  std::unordered_map<int, SepCacheEntry>::iterator it = sep_cache_.find(id);
+  if (it == sep_cache_.end()) {
+    if (sep_cache_.size() >= kMaxCachedComps) {
+      sep_cache_.clear();
     }
-  } else {  // maxfrac is < 1
-    // push back any leftover feed due to separated stream inv size constraints
-    feed.Push(mat->ExtractQty((1 - maxfrac) * orig_qty));
-    if (mat->quantity() > 0) {
-      // unspecified separations fractions go to leftovers
-      leftover.Push(mat);
+    Material::Ptr unit = Material::CreateUntracked(1, mat->comp());
+    std::vector<CompMap> sepcomps;
+    std::vector<double> sepqtys;
+    sep_matrix_.Separate(unit, &sepcomps, &sepqtys);
+
+    SepCacheEntry& entry = sep_cache_[id];
+    for (int i = 0; i < sepcomps.size(); i++) {
+      if (sepqtys[i] > 0) {
+        entry.comps.push_back(Composition::CreateFromMass(sepcomps[i]));
+      } else {
+        entry.comps.push_back(Composition::Ptr());
+      }
+      entry.fracs.push_back(sepqtys[i]);
     }
+    it = sep_cache_.find(id);
+  }
+
+  const SepCacheEntry& entry = it->second;
+  *comps = entry.comps;
+  qtys->resize(entry.fracs.size());
+  for (int i = 0; i < entry.fracs.size(); i++) {
+    (*qtys)[i] = entry.fracs[i] * mat->quantity();
   }
 }
 
 // Note that this returns an untracked material that should just be used for
 // its composition and qty - not in any real inventories, etc.
-Material::Ptr SepMaterial(std::map<int, double> effs, Material::Ptr mat) {
+Material::Ptr SepMaterial(const std::map<int, double>& effs,
+                          Material::Ptr mat) {
   CompMap cm = mat->comp()->mass();
   cyclus::compmath::Normalize(&cm, mat->quantity());
   double tot_qty = 0;
@@ -156,13 +606,14 @@ Material::Ptr SepMaterial(std::map<int, double> effs, Material::Ptr mat) {
     int nuc = it->first;
     int elem = (nuc / 10000000) * 10000000;
     double eff = 0;
-    if (effs.count(nuc) > 0) {
-      eff = effs[nuc];
-    } else if (effs.count(elem) > 0) {
-      eff = effs[elem];
-    } else {
+    std::map<int, double>::const_iterator e = effs.find(nuc);
+    if (e == effs.end()) {
+      e = effs.find(elem);
+    }
+    if (e == effs.end()) {
       continue;
     }
+    eff = e->second;
 
     double qty = it->second;
     double sepqty = qty * eff;
@@ -174,6 +625,109 @@ Material::Ptr SepMaterial(std::map<int, double> effs, Material::Ptr mat) {
   return Material::CreateUntracked(tot_qty, c);
 };
 
+void SepMatrix::Compile(const std::vector<std::map<int, double> >& effs) {
+  nstreams_ = effs.size();
+  comps_.clear();
+  rows_.clear();
+  effs_.clear();
+  sepqty_.assign(nstreams_, 0);
+
+  for (int i = 0; i < nstreams_; i++) {
+    std::map<int, double>::const_iterator it;
+    for (it = effs[i].begin(); it != effs[i].end(); ++it) {
+      std::vector<double>& comp = comps_[it->first];
+      comp.resize(nstreams_, -1);
+      comp[i] = it->second;
+    }
+  }
+}
+
+int SepMatrix::Row_(int nuc) {
+  std::unordered_map<int, int>::iterator it = rows_.find(nuc);
+  if (it != rows_.end()) {
+    return it->second;
+  }
+
+  std::map<int, std::vector<double> >::iterator n = comps_.find(nuc);
+  std::map<int, std::vector<double> >::iterator e =
+      comps_.find((nuc / 10000000) * 10000000);
+  int row = effs_.size();
+  for (int i = 0; i < nstreams_; i++) {
+    double eff = 0;
+    if (n != comps_.end() && n->second[i] >= 0) {
+      eff = n->second[i];
+    } else if (e != comps_.end() && e->second[i] >= 0) {
+      eff = e->second[i];
+    }
+    effs_.push_back(eff);
+  }
+  rows_[nuc] = row;
+  return row;
+}
+
+void SepMatrix::Expand(const CompMap& comp) {
+  CompMap::const_iterator it;
+  for (it = comp.begin(); it != comp.end(); ++it) {
+    Row_(it->first);
+  }
+}
+
+std::vector<int> SepMatrix::Overallocated() const {
+  // a nuclide's efficiency in each stream comes from its own entry or its
+  // element's, so totals are checked for every named nuclide and for the
+  // other nuclides of every named element
+  std::vector<int> over;
+  std::map<int, std::vector<double> >::const_iterator it;
+  for (it = comps_.begin(); it != comps_.end(); ++it) {
+    int elem = (it->first / 10000000) * 10000000;
+    std::map<int, std::vector<double> >::const_iterator e = comps_.find(elem);
+    double tot = 0;
+    for (int i = 0; i < nstreams_; i++) {
+      if (it->second[i] >= 0) {
+        tot += it->second[i];
+      } else if (e != comps_.end() && e->second[i] >= 0) {
+        tot += e->second[i];
+      }
+    }
+    if (tot > 1) {
+      over.push_back(it->first);
+    }
+  }
+  return over;
+}
+
+void SepMatrix::Separate(Material::Ptr mat, std::vector<CompMap>* comps,
+                         std::vector<double>* qtys) {
+  comps->assign(nstreams_, CompMap());
+  qtys->assign(nstreams_, 0);
+
+  const CompMap& cm = mat->comp()->mass();
+  double norm = 0;
+  CompMap::const_iterator it;
+  for (it = cm.begin(); it != cm.end(); ++it) {
+    norm += it->second;
+  }
+  if (norm <= 0) {
+    return;
+  }
+  double scale = mat->quantity() / norm;
+
+  for (it = cm.begin(); it != cm.end(); ++it) {
+    const double* row = &effs_[Row_(it->first)];
+    double qty = it->second * scale;
+    double* sepqty = &sepqty_[0];
+    for (int i = 0; i < nstreams_; i++) {
+      sepqty[i] = qty * row[i];
+    }
+    for (int i = 0; i < nstreams_; i++) {
+      if (row[i] > 0) {
+        (*comps)[i][it->first] = sepqty[i];
+        (*qtys)[i] += sepqty[i];
+      }
+    }
+  }
+}
+
 std::set<cyclus::RequestPortfolio<Material>::Ptr>
 Separations::GetMatlRequests() {
   using cyclus::RequestPortfolio;
@@ -183,17 +737,19 @@ Separations::GetMatlRequests() {
   int t_exit = exit_time();
   if (t_exit >= 0 && (feed.quantity() >= (t_exit - t) * throughput)) {
     return ports;  // already have enough feed for remainder of life
-  } else if (feed.space() < cyclus::eps_rsrc()) {
+  }
+  double qty = RequestQty_();
+  if (qty < cyclus::eps_rsrc()) {
     return ports;
   }
 
   bool exclusive = false;
   RequestPortfolio<Material>::Ptr port(new RequestPortfolio<Material>());
 
-  Material::Ptr m = cyclus::NewBlankMaterial(feed.space());
+  Material::Ptr m = cyclus::NewBlankMaterial(qty);
   if (!feed_recipe.empty()) {
     Composition::Ptr c = context()->GetRecipe(feed_recipe);
-    m = Material::CreateUntracked(feed.space(), c);
+    m = Material::CreateUntracked(qty, c);
   }
 
   std::vector<cyclus::Request<Material>*> reqs;
@@ -208,6 +764,21 @@ Separations::GetMatlRequests() {
   return ports;
 }
 
+double Separations::RequestQty_() {
+  if (request_horizon <= 0) {
+    return feed.space();
+  }
+
+  // feed needed to keep processing at full rate over the horizon
+  double need = request_horizon * ProcessRate_() - feed.quantity();
+
+  // feed the stream and leftover buffers have room for once everything on
+  // hand and in process has been separated
+  need = std::min(need, StreamRoom_() - feed.quantity());
+
+  return std::max(0.0, std::min(feed.space(), need));
+}
+
 void Separations::GetMatlTrades(
     const std::vector<cyclus::Trade<Material> >& trades,
     std::vector<std::pair<cyclus::Trade<Material>, Material::Ptr> >&
@@ -239,6 +810,15 @@ void Separations::AcceptMatlTrades(
                         cyclus::Material::Ptr> >::const_iterator trade;
 
   for (trade = responses.begin(); trade != responses.end(); ++trade) {
+    if (feed_order_ == kPriorityOrder) {
+      std::string commod = trade->first.request->commodity();
+      for (int i = 0; i < feed_commods.size(); i++) {
+        if (feed_commods[i] == commod) {
+          lot_prefs[trade->second->obj_id()] = feed_commod_prefs[i];
+          break;
+        }
+      }
+    }
     feed.Push(trade->second);
   }
 }
@@ -247,92 +827,94 @@ std::set<cyclus::BidPortfolio<Material>::Ptr> Separations::GetMatlBids(
     cyclus::CommodMap<Material>::type& commod_requests) {
   using cyclus::BidPortfolio;
 
-  bool exclusive = false;
   std::set<BidPortfolio<Material>::Ptr> ports;
 
   // bid streams
   std::map<std::string, ResBuf<Material> >::iterator it;
   for (it = streambufs.begin(); it != streambufs.end(); ++it) {
-    std::string commod = it->first;
-    std::vector<Request<Material>*>& reqs = commod_requests[commod];
-    if (reqs.size() == 0) {
-      continue;
-    } else if (streambufs[commod].quantity() < cyclus::eps_rsrc()) {
-      continue;
-    }
-
-    MatVec mats = streambufs[commod].PopN(streambufs[commod].count());
-    streambufs[commod].Push(mats);
-
-    BidPortfolio<Material>::Ptr port(new BidPortfolio<Material>());
-
-    for (int j = 0; j < reqs.size(); j++) {
-      Request<Material>* req = reqs[j];
-      double tot_bid = 0;
-      for (int k = 0; k < mats.size(); k++) {
-        Material::Ptr m = mats[k];
-        tot_bid += m->quantity();
-
-        // this fix the problem of the cyclus exchange manager which crashes
-        // when a bid with a quantity <=0 is offered.
-        if (m->quantity() > cyclus::eps_rsrc()) {
-          port->AddBid(req, m, this, exclusive);
-        }
-
-        if (tot_bid >= req->target()->quantity()) {
-          break;
-        }
-      }
+    std::vector<Request<Material>*>& reqs = commod_requests[it->first];
+    if (reqs.size() > 0 && it->second.quantity() >= cyclus::eps_rsrc()) {
+      ports.insert(BidBuf_(&it->second, reqs));
     }
-
-    double tot_qty = streambufs[commod].quantity();
-    cyclus::CapacityConstraint<Material> cc(tot_qty);
-    port->AddConstraint(cc);
-    ports.insert(port);
   }
 
   // bid leftovers
   std::vector<Request<Material>*>& reqs = commod_requests[leftover_commod];
   if (reqs.size() > 0 && leftover.quantity() >= cyclus::eps_rsrc()) {
-    MatVec mats = leftover.PopN(leftover.count());
-    leftover.Push(mats);
-
-    BidPortfolio<Material>::Ptr port(new BidPortfolio<Material>());
-
-    for (int j = 0; j < reqs.size(); j++) {
-      Request<Material>* req = reqs[j];
-      double tot_bid = 0;
-      for (int k = 0; k < mats.size(); k++) {
-        Material::Ptr m = mats[k];
-        tot_bid += m->quantity();
-
-        // this fix the problem of the cyclus exchange manager which crashes
-        // when a bid with a quantity <=0 is offered.
-        if (m->quantity() > cyclus::eps_rsrc()) {
-          port->AddBid(req, m, this, exclusive);
-        }
+    ports.insert(BidBuf_(&leftover, reqs));
+  }
 
-        if (tot_bid >= req->target()->quantity()) {
-          break;
-        }
-      }
-    }
+  return ports;
+}
+
+cyclus::BidPortfolio<Material>::Ptr Separations::BidBuf_(
+    ResBuf<Material>* buf, const std::vector<Request<Material>*>& reqs) {
+  using cyclus::BidPortfolio;
 
-    cyclus::CapacityConstraint<Material> cc(leftover.quantity());
-    port->AddConstraint(cc);
-    ports.insert(port);
+  // Tick pushes a new material into every buffer each time step, so they are
+  // consolidated here to keep the number of bids independent of how long
+  // material has been accumulating.  Trades pop by quantity, so what is
+  // shipped matches the offered composition.
+  if (buf->count() > 1) {
+    buf->Push(cyclus::toolkit::Squash(buf->PopN(buf->count())));
   }
+  Material::Ptr m = buf->Peek();
 
-  return ports;
+  bool exclusive = false;
+  BidPortfolio<Material>::Ptr port(new BidPortfolio<Material>());
+  for (int j = 0; j < reqs.size(); j++) {
+    port->AddBid(reqs[j], m, this, exclusive);
+  }
+
+  cyclus::CapacityConstraint<Material> cc(buf->quantity());
+  port->AddConstraint(cc);
+  return port;
 }
 
-void Separations::Tock() {}
+void Separations::Tock() {
+  for (int i = 0; i < stream_names_.size(); i++) {
+    if (throttled_[i] > cyclus::eps_rsrc() || spilled_[i] > cyclus::eps_rsrc()) {
+      context()
+          ->NewDatum("SeparationsThrottle")
+          ->AddVal("AgentId", id())
+          ->AddVal("Time", context()->time())
+          ->AddVal("Stream", stream_names_[i])
+          ->AddVal("FeedHeld", throttled_[i])
+          ->AddVal("Spilled", spilled_[i])
+          ->Record();
+    }
+  }
+  if (leftover_held_ > cyclus::eps_rsrc()) {
+    context()
+        ->NewDatum("SeparationsThrottle")
+        ->AddVal("AgentId", id())
+        ->AddVal("Time", context()->time())
+        ->AddVal("Stream", leftover_commod)
+        ->AddVal("FeedHeld", leftover_held_)
+        ->AddVal("Spilled", 0.0)
+        ->Record();
+  }
+  throttled_.assign(stream_names_.size(), 0);
+  spilled_.assign(stream_names_.size(), 0);
+  leftover_held_ = 0;
+}
 
 bool Separations::CheckDecommissionCondition() {
   if (leftover.count() > 0) {
     return false;
   }
 
+  for (int i = 0; i < waiting_.size(); i++) {
+    if (!waiting_[i].empty()) {
+      return false;
+    }
+  }
+  for (int i = 0; i < calendar_.size(); i++) {
+    if (!calendar_[i].empty()) {
+      return false;
+    }
+  }
+
   std::map<std::string, ResBuf<Material> >::iterator it;
   for (it = streambufs.begin(); it != streambufs.end(); ++it) {
     if (it->second.count() > 0) {
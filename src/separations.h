@@ -1,6 +1,12 @@
 #ifndef CYCAMORE_SRC_SEPARATIONS_H_
 #define CYCAMORE_SRC_SEPARATIONS_H_
 
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include "cyclus.h"
 #include "cycamore_version.h"
 
@@ -13,9 +19,55 @@ namespace cycamore {
 /// separations efficiency for that nuclide or element.  Note that this returns
 /// an untracked material that should only be used for its composition and qty
 /// - not in any real inventories, etc.
-cyclus::Material::Ptr SepMaterial(std::map<int, double> effs,
+cyclus::Material::Ptr SepMaterial(const std::map<int, double>& effs,
                                   cyclus::Material::Ptr mat);
 
+/// SepMatrix holds the separations efficiencies of a set of streams as a dense
+/// matrix with one row per nuclide and one column per stream, so a single pass
+/// over a feed composition separates it into every stream at once.  Element
+/// efficiencies are expanded to rows for the nuclides of known compositions
+/// (see Expand), and rows for any other nuclide are resolved the first time it
+/// is seen, with nuclide efficiencies taking precedence over element
+/// efficiencies as in SepMaterial.
+class SepMatrix {
+ public:
+  SepMatrix() : nstreams_(0) {}
+
+  /// Compiles the efficiencies of each stream, in stream order.
+  void Compile(const std::vector<std::map<int, double> >& effs);
+
+  /// Resolves the rows of every nuclide in comp up front, so separating
+  /// material of that composition only does row lookups.
+  void Expand(const cyclus::CompMap& comp);
+
+  /// Returns the nuclides and elements whose efficiencies, resolved per
+  /// stream as in SepMaterial, sum to more than 1 across all streams.
+  std::vector<int> Overallocated() const;
+
+  /// Separates mat into every stream. On return (*comps)[i] and (*qtys)[i]
+  /// hold the separated mass composition and quantity of stream i.
+  void Separate(cyclus::Material::Ptr mat, std::vector<cyclus::CompMap>* comps,
+                std::vector<double>* qtys);
+
+ private:
+  /// Returns the offset of nuclide nuc's row in effs_, resolving it first if
+  /// needed.
+  int Row_(int nuc);
+
+  int nstreams_;
+
+  // component (nuclide or element) efficiencies per stream, negative if the
+  // stream doesn't name the component
+  std::map<int, std::vector<double> > comps_;
+
+  // resolved nuclide rows and their offsets in the row-major effs_
+  std::unordered_map<int, int> rows_;
+  std::vector<double> effs_;
+
+  // per-nuclide scratch space for Separate
+  std::vector<double> sepqty_;
+};
+
 /// Separations processes feed material into one or more streams containing
 /// specific elements and/or nuclides.  It uses mass-based efficiencies.
 ///
@@ -152,6 +204,94 @@ class Separations : public cyclus::Facility {
   }
   double throughput;
 
+  #pragma cyclus var { \
+    "doc": "Order in which received feed lots are processed. 'batch' merges " \
+           "feed up to the throughput into a single material before " \
+           "separating it. 'fifo' separates each lot on its own in the order " \
+           "it was received, and 'priority' does the same in order of the " \
+           "preference of the feed commodity each lot was received on. In the " \
+           "lot modes consecutive lots of identical composition are separated " \
+           "together, and each lot processed is recorded in the " \
+           "SeparationsLots table.", \
+    "uilabel": "Feed Processing Order", \
+    "default": "batch", \
+    "categorical": ["batch", "fifo", "priority"], \
+    "userlevel": 10, \
+  }
+  std::string feed_order;
+
+  // feed_order, parsed by EnterNotify
+  enum FeedOrder { kBatchOrder, kFifoOrder, kPriorityOrder };
+  FeedOrder feed_order_;
+
+  #pragma cyclus var { \
+    "default": [], \
+    "doc": "Residence time of each processing stage (e.g. cooling, " \
+           "dissolution, separation) that feed passes through in order. Feed " \
+           "taken for processing enters the first stage and is separated when " \
+           "it leaves the last one. If empty, feed is separated in the time " \
+           "step it is taken.", \
+    "uilabel": "Processing Stage Durations", \
+    "units": "time steps", \
+    "userlevel": 10, \
+  }
+  std::vector<int> stage_durations;
+
+  #pragma cyclus var { \
+    "default": [], \
+    "doc": "Maximum quantity of material that can enter each processing " \
+           "stage per time step (same order as stage_durations). Stages " \
+           "without a capacity are unlimited. Entry to the first stage is " \
+           "also limited by throughput.", \
+    "uilabel": "Processing Stage Capacities", \
+    "units": "kg/(time step)", \
+    "userlevel": 10, \
+  }
+  std::vector<double> stage_capacities;
+
+  #pragma cyclus var { \
+    "default": 0, \
+    "doc": "Number of time steps of feed to request ahead of need. If " \
+           "positive, feed requests are sized to keep the facility " \
+           "processing at its throughput and stream rate limits for this " \
+           "many time steps, limited to what the stream and leftover " \
+           "buffers have room for when separating the feed recipe. If zero, " \
+           "the facility requests enough to fill its feed inventory.", \
+    "uilabel": "Feed Request Horizon", \
+    "units": "time steps", \
+    "userlevel": 10, \
+  }
+  int request_horizon;
+
+  #pragma cyclus var { \
+    "default": {}, \
+    "alias": ["stream_rate_limits", "stream", "rate"], \
+    "uitype": ["oneormore", "outcommodity", "double"], \
+    "doc": "Maximum quantity of material that can be separated into a " \
+           "stream per time step, by stream commodity. Streams without a " \
+           "limit are only limited by their buffer size.", \
+    "uilabel": "Stream Output Rate Limits", \
+    "units": "kg/(time step)", \
+    "userlevel": 10, \
+  }
+  std::map<std::string, double> stream_rate_limits;
+
+  #pragma cyclus var { \
+    "default": [], \
+    "uitype": ["oneormore", "outcommodity"], \
+    "doc": "Streams that spill rather than hold up processing. Material " \
+           "separated into one of these streams beyond its buffer space or " \
+           "rate limit is sent to the leftover stream, while other streams " \
+           "that are full or at their rate limit, and a full leftover " \
+           "buffer, stop processing until room is available. Feed held back " \
+           "and material spilled because of each stream, and feed held back " \
+           "because of the leftover buffer, are recorded in the " \
+           "SeparationsThrottle table.", \
+    "uilabel": "Spilling Streams", \
+    "userlevel": 10, \
+  }
+  std::vector<std::string> spill_streams;
+
   #pragma cyclus var { \
     "doc": "Commodity on which to trade the leftover separated material " \
            "stream. This MUST NOT be the same as any commodity used to define "\
@@ -203,6 +343,137 @@ class Separations : public cyclus::Facility {
   // custom SnapshotInv and InitInv and EnterNotify are used to persist this
   // state var.
   std::map<std::string, cyclus::toolkit::ResBuf<cyclus::Material> > streambufs;
+
+  // stream names and buffers in streams_ order and their compiled
+  // efficiencies, built by EnterNotify
+  std::vector<std::string> stream_names_;
+  std::vector<cyclus::toolkit::ResBuf<cyclus::Material>*> stream_bufs_;
+  SepMatrix sep_matrix_;
+
+  /// Separates as much of mat into the stream buffers as they have room for,
+  /// sending unseparated material to leftover.  Returns the unprocessed
+  /// portion of mat, or a null pointer if all of it was processed.
+  cyclus::Material::Ptr Process_(cyclus::Material::Ptr mat);
+
+  /// Takes mat for processing, either separating it immediately or sending it
+  /// into the first processing stage.  Returns the portion of mat that could
+  /// not be taken, or a null pointer.
+  cyclus::Material::Ptr Intake_(cyclus::Material::Ptr mat);
+
+  /// Returns the quantity of feed that can be taken this time step.
+  double IntakeCapacity_();
+
+  /// Returns the quantity of feed recipe material the stream and leftover
+  /// buffers have room for once everything in process has been separated.
+  /// Unbounded if there is no feed recipe.
+  double StreamRoom_();
+
+  /// Returns the quantity of feed recipe material that can be separated per
+  /// time step within the throughput and the stream rate limits.
+  double ProcessRate_();
+
+  /// Sizes the processing stage containers for stage_durations, keeping any
+  /// lots already in them.
+  void SizePipeline_();
+
+  /// Puts a lot read by InitInv back into stage stage, due to finish it at
+  /// time step ready, or waiting on the next stage if ready is negative.
+  void RestoreLot_(int stage, int ready, cyclus::Material::Ptr mat);
+
+  /// Sends mat into processing stage stage.
+  void EnterStage_(int stage, cyclus::Material::Ptr mat);
+
+  /// Moves lots finishing their stage this time step to the waiting queues.
+  void StartPipelineStep_();
+
+  /// Moves waiting lots into their next stage, or separates them after the
+  /// last one, as stage capacities and stream buffer space allow.
+  void AdvancePipeline_();
+
+  // a lot in a processing stage and the time step it finishes that stage
+  struct PipeLot {
+    cyclus::Material::Ptr mat;
+    int stage;
+    int ready;
+  };
+
+  // calendar of in-process lots by the time step they finish their stage,
+  // as a ring indexed by time modulo its size (the longest stage + 1) so each
+  // time step only touches the lots that advance
+  std::vector<std::vector<PipeLot> > calendar_;
+
+  // lots that finished each stage and are waiting to enter the next one
+  std::vector<std::deque<cyclus::Material::Ptr> > waiting_;
+
+  // room left in each stage this time step
+  std::vector<double> stage_room_;
+
+  // per-stream output rate limits, spill flags and quantity separated this
+  // time step, in stream order
+  std::vector<double> stream_rates_;
+  std::vector<bool> stream_spill_;
+  std::vector<double> stream_out_;
+
+  // feed held back because of, and material spilled from, each stream this
+  // time step
+  std::vector<double> throttled_;
+  std::vector<double> spilled_;
+
+  // feed held back because the leftover buffer is full this time step
+  double leftover_held_;
+
+  /// Returns the quantity sent to leftovers when processing frac of qty kg
+  /// of feed that separates into sepqtys, given the room in each stream.
+  double LeftoverQty_(double frac, double qty,
+                      const std::vector<double>& sepqtys,
+                      const std::vector<double>& room);
+
+  /// Returns the largest fraction, up to maxfrac, of qty kg of feed whose
+  /// leftovers fit in the leftover buffer.
+  double LeftoverLimit_(double qty, const std::vector<double>& sepqtys,
+                        const std::vector<double>& room, double maxfrac);
+
+  // quantity of feed taken into the pipeline and not yet separated
+  double pipeline_qty_;
+
+  /// Returns the quantity of feed to request this time step.
+  double RequestQty_();
+
+  // separated stream mass per unit mass of the feed recipe, in stream order
+  std::vector<double> feed_sep_fracs_;
+
+  /// Returns a portfolio bidding the contents of buf against each of reqs.
+  cyclus::BidPortfolio<cyclus::Material>::Ptr BidBuf_(
+      cyclus::toolkit::ResBuf<cyclus::Material>* buf,
+      const std::vector<cyclus::Request<cyclus::Material>*>& reqs);
+
+  /// Processes feed lot by lot in feed_order order, up to the throughput.
+  void ProcessLots_();
+
+  /// Records that qty kg of feed lot lot was taken for processing.
+  void RecordLot_(cyclus::Material::Ptr lot, double qty);
+
+  // feed commodity preference of each feed lot by object id, used to order
+  // lots when feed_order is 'priority'
+  #pragma cyclus var {"default": {}, "internal": True}
+  std::map<int, double> lot_prefs;
+
+  /// Separates mat into every stream, returning the composition and quantity
+  /// of each stream in stream_names_ order.  Results are cached per feed
+  /// composition so repeated feeds reuse the same stream Compositions.
+  void Separate_(cyclus::Material::Ptr mat,
+                 std::vector<cyclus::Composition::Ptr>* comps,
+                 std::vector<double>* qtys);
+
+  // stream compositions and separated mass per unit mass of feed, keyed by
+  // feed composition id
+  struct SepCacheEntry {
+    std::vector<cyclus::Composition::Ptr> comps;
+    std::vector<double> fracs;
+  };
+  std::unordered_map<int, SepCacheEntry> sep_cache_;
+
+  friend class SeparationsTest;
 };
 
 }  // namespace cycamore
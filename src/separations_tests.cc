@@ -1,8 +1,11 @@
 #include "separations.h"
 
 #include <gtest/gtest.h>
+#include <set>
 #include <sstream>
+#include <tuple>
 #include "cyclus.h"
+#include "test_context.h"
 
 using pyne::nucname::id;
 using cyclus::Composition;
@@ -43,6 +46,68 @@ TEST(SeparationsTests, SepMaterial) {
   EXPECT_DOUBLE_EQ(0, mqsep.mass("Am242"));
 }
 
+TEST(SeparationsTests, SepMatrix) {
+  CompMap comp;
+  comp[id("U235")] = 10;
+  comp[id("U238")] = 90;
+  comp[id("Pu239")] = 1;
+  comp[id("Pu240")] = 2;
+  comp[id("Am241")] = 3;
+  comp[id("Am242")] = 2.8;
+  double qty = 100;
+  Composition::Ptr c = Composition::CreateFromMass(comp);
+  Material::Ptr mat = Material::CreateUntracked(qty, c);
+
+  std::vector<std::map<int, double> > effs(3);
+  effs[0][id("U")] = .7;
+  effs[0][id("Pu")] = .4;
+  effs[0][id("Am241")] = .4;
+  effs[1][id("Pu")] = .5;
+  effs[1][id("Pu240")] = .1;
+  effs[2][id("Am")] = .2;
+
+  SepMatrix m;
+  m.Compile(effs);
+  std::vector<CompMap> comps;
+  std::vector<double> qtys;
+  // twice, so the second pass uses the cached rows
+  for (int pass = 0; pass < 2; pass++) {
+    m.Separate(mat, &comps, &qtys);
+    ASSERT_EQ(3, comps.size());
+    for (int i = 0; i < 3; i++) {
+      Material::Ptr want = SepMaterial(effs[i], mat);
+      EXPECT_DOUBLE_EQ(want->quantity(), qtys[i]);
+      MatQuery mqwant(want);
+      MatQuery mqgot(Material::CreateUntracked(
+          qtys[i], Composition::CreateFromMass(comps[i])));
+      CompMap::iterator it;
+      for (it = comp.begin(); it != comp.end(); ++it) {
+        EXPECT_NEAR(mqwant.mass(it->first), mqgot.mass(it->first), 1e-10);
+      }
+    }
+  }
+  EXPECT_EQ(0, comps[2].count(id("U238")));
+}
+
+// Element efficiencies apply to every nuclide of the element a stream doesn't
+// name on its own, so they must be checked against other streams' nuclide
+// efficiencies.
+TEST(SeparationsTests, SepMatrixOverallocated) {
+  std::vector<std::map<int, double> > effs(2);
+  effs[0][id("U")] = .6;
+  effs[1][id("U235")] = .6;
+
+  SepMatrix m;
+  m.Compile(effs);
+  std::vector<int> over = m.Overallocated();
+  ASSERT_EQ(1, over.size());
+  EXPECT_EQ(id("U235"), over[0]);
+
+  effs[0][id("U235")] = .1;
+  m.Compile(effs);
+  EXPECT_EQ(0, m.Overallocated().size());
+}
+
   
 // Check that cumulative separations efficiency for a single nuclide of less than or equal to one does not trigger an error.
 TEST(SeparationsTests, SeparationEfficiency) {
@@ -281,6 +346,482 @@ TEST(SeparationsTests, SepMixElemAndNuclide) {
   EXPECT_DOUBLE_EQ(0, mq.mass("Pu240"));
 }
 
+// Repeated feeds of the same composition should reuse the same separated
+// stream composition rather than creating a new one every time step.
+TEST(SeparationsTests, SepCompCache) {
+  std::string config =
+      "<streams>"
+      "    <item>"
+      "        <commod>stream1</commod>"
+      "        <info>"
+      "            <buf_size>-1</buf_size>"
+      "            <efficiencies>"
+      "                <item><comp>Pu</comp> <eff>.9</eff></item>"
+      "            </efficiencies>"
+      "        </info>"
+      "    </item>"
+      "</streams>"
+      ""
+      "<leftover_commod>waste</leftover_commod>"
+      "<throughput>100</throughput>"
+      "<feedbuf_size>100</feedbuf_size>"
+      "<feed_commods> <val>feed</val> </feed_commods>"
+     ;
+
+  CompMap m;
+  m[id("u238")] = 0.9;
+  m[id("Pu239")] = .06;
+  m[id("Pu240")] = .04;
+  Composition::Ptr c = Composition::CreateFromMass(m);
+
+  int simdur = 4;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Separations"), config, simdur);
+  sim.AddSource("feed").recipe("recipe1").capacity(100).Finalize();
+  sim.AddSink("stream1").capacity(100).Finalize();
+  sim.AddRecipe("recipe1", c);
+  int id = sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("SenderId", "==", id));
+  QueryResult qr = sim.db().Query("Transactions", &conds);
+  ASSERT_LE(2, qr.rows.size());
+
+  std::set<int> qualids;
+  for (int i = 0; i < qr.rows.size(); i++) {
+    int resid = qr.GetVal<int>("ResourceId", i);
+    std::vector<Cond> rconds;
+    rconds.push_back(Cond("ResourceId", "==", resid));
+    qualids.insert(
+        sim.db().Query("Resources", &rconds).GetVal<int>("QualId"));
+    MatQuery mq(sim.GetMaterial(resid));
+    EXPECT_DOUBLE_EQ(m[942390000] * 0.9 * 100, mq.mass("Pu239"));
+  }
+  EXPECT_EQ(1, qualids.size());
+}
+
+// In priority mode lots received on a more preferred feed commodity are
+// processed before older lots received on a less preferred one.
+TEST(SeparationsTests, FeedOrderPriority) {
+  std::string config =
+      "<streams>"
+      "    <item>"
+      "        <commod>stream1</commod>"
+      "        <info>"
+      "            <buf_size>-1</buf_size>"
+      "            <efficiencies>"
+      "                <item><comp>Pu</comp> <eff>.9</eff></item>"
+      "            </efficiencies>"
+      "        </info>"
+      "    </item>"
+      "</streams>"
+      ""
+      "<leftover_commod>waste</leftover_commod>"
+      "<throughput>10</throughput>"
+      "<feedbuf_size>1000</feedbuf_size>"
+      "<feed_commods> <val>feedA</val> <val>feedB</val> </feed_commods>"
+      "<feed_commod_prefs> <val>1</val> <val>2</val> </feed_commod_prefs>"
+      "<feed_order>priority</feed_order>"
+     ;
+
+  CompMap ma;
+  ma[id("u238")] = 0.95;
+  ma[id("Pu239")] = .05;
+  CompMap mb;
+  mb[id("u238")] = 0.9;
+  mb[id("Pu239")] = .1;
+
+  int simdur = 3;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Separations"), config, simdur);
+  sim.AddSource("feedA").recipe("recipeA").capacity(100).Finalize();
+  sim.AddSource("feedB").recipe("recipeB").capacity(100).start(1).Finalize();
+  sim.AddRecipe("recipeA", Composition::CreateFromMass(ma));
+  sim.AddRecipe("recipeB", Composition::CreateFromMass(mb));
+  int id = sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("ReceiverId", "==", id));
+  conds.push_back(Cond("Commodity", "==", std::string("feedB")));
+  int resid = sim.db().Query("Transactions", &conds).GetVal<int>("ResourceId");
+  conds.clear();
+  conds.push_back(Cond("ResourceId", "==", resid));
+  int qualb = sim.db().Query("Resources", &conds).GetVal<int>("QualId");
+
+  conds.clear();
+  conds.push_back(Cond("AgentId", "==", id));
+  conds.push_back(Cond("Time", "==", 2));
+  QueryResult qr = sim.db().Query("SeparationsLots", &conds);
+  ASSERT_EQ(1, qr.rows.size());
+  EXPECT_EQ(qualb, qr.GetVal<int>("QualId"));
+  EXPECT_DOUBLE_EQ(10, qr.GetVal<double>("Quantity"));
+}
+
+TEST(SeparationsTests, FeedOrderInvalid) {
+  std::string config =
+      "<streams>"
+      "    <item>"
+      "        <commod>stream1</commod>"
+      "        <info>"
+      "            <buf_size>-1</buf_size>"
+      "            <efficiencies>"
+      "                <item><comp>Pu</comp> <eff>.9</eff></item>"
+      "            </efficiencies>"
+      "        </info>"
+      "    </item>"
+      "</streams>"
+      ""
+      "<leftover_commod>waste</leftover_commod>"
+      "<throughput>10</throughput>"
+      "<feedbuf_size>1000</feedbuf_size>"
+      "<feed_commods> <val>feed</val> </feed_commods>"
+      "<feed_order>lifo</feed_order>"
+     ;
+
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Separations"), config, 1);
+  EXPECT_THROW(sim.Run(), cyclus::ValueError);
+}
+
+// Feed passes through each processing stage, limited by the stage
+// capacities, before it is separated.
+TEST(SeparationsTests, Pipeline) {
+  std::string config =
+      "<streams>"
+      "    <item>"
+      "        <commod>stream1</commod>"
+      "        <info>"
+      "            <buf_size>-1</buf_size>"
+      "            <efficiencies>"
+      "                <item><comp>Pu</comp> <eff>1.0</eff></item>"
+      "            </efficiencies>"
+      "        </info>"
+      "    </item>"
+      "</streams>"
+      ""
+      "<leftover_commod>waste</leftover_commod>"
+      "<throughput>100</throughput>"
+      "<feedbuf_size>100</feedbuf_size>"
+      "<feed_commods> <val>feed</val> </feed_commods>"
+      "<stage_durations> <val>1</val> <val>2</val> </stage_durations>"
+      "<stage_capacities> <val>100</val> <val>30</val> </stage_capacities>"
+     ;
+
+  CompMap m;
+  m[id("u238")] = 0.9;
+  m[id("Pu239")] = .1;
+  Composition::Ptr c = Composition::CreateFromMass(m);
+
+  // feed arrives at t=0, enters stage 1 at t=1, 30 kg of it enters stage 2
+  // at t=2 and is separated at t=4
+  int simdur = 5;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Separations"), config, simdur);
+  sim.AddSource("feed").recipe("recipe1").capacity(100).lifetime(1).Finalize();
+  sim.AddSink("stream1").capacity(100).Finalize();
+  sim.AddRecipe("recipe1", c);
+  int id = sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("SenderId", "==", id));
+  QueryResult qr = sim.db().Query("Transactions", &conds);
+  ASSERT_EQ(1, qr.rows.size());
+  EXPECT_EQ(4, qr.GetVal<int>("Time"));
+  Material::Ptr mat = sim.GetMaterial(qr.GetVal<int>("ResourceId"));
+  EXPECT_NEAR(3, mat->quantity(), 1e-10);
+}
+
+// Feed only enters the pipeline as far as the stream buffers will have room
+// for it once it is separated.
+TEST(SeparationsTests, PipelineStreamRoom) {
+  std::string config =
+      "<streams>"
+      "    <item>"
+      "        <commod>stream1</commod>"
+      "        <info>"
+      "            <buf_size>2</buf_size>"
+      "            <efficiencies>"
+      "                <item><comp>Pu</comp> <eff>1.0</eff></item>"
+      "            </efficiencies>"
+      "        </info>"
+      "    </item>"
+      "</streams>"
+      ""
+      "<leftover_commod>waste</leftover_commod>"
+      "<throughput>100</throughput>"
+      "<feedbuf_size>100</feedbuf_size>"
+      "<feed_commods> <val>feed</val> </feed_commods>"
+      "<feed_recipe>recipe1</feed_recipe>"
+      "<stage_durations> <val>1</val> </stage_durations>"
+     ;
+
+  CompMap m;
+  m[id("u238")] = 0.9;
+  m[id("Pu239")] = .1;
+  Composition::Ptr c = Composition::CreateFromMass(m);
+
+  // 100 kg of feed arrive at t=0, but the 2 kg stream buffer only has room
+  // for 20 kg of it, so only 20 kg enter the pipeline at t=1 and only 20 kg
+  // are requested to refill the feed inventory
+  int simdur = 2;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Separations"), config, simdur);
+  sim.AddSource("feed").recipe("recipe1").Finalize();
+  sim.AddRecipe("recipe1", c);
+  int id = sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("ReceiverId", "==", id));
+  conds.push_back(Cond("Time", "==", 1));
+  QueryResult qr = sim.db().Query("Transactions", &conds);
+  ASSERT_EQ(1, qr.rows.size());
+  Material::Ptr mat = sim.GetMaterial(qr.GetVal<int>("ResourceId"));
+  EXPECT_NEAR(20, mat->quantity(), 1e-6);
+}
+
+// With a request horizon, feed requests cover the throughput over the horizon
+// rather than the whole feed inventory.
+TEST(SeparationsTests, RequestHorizon) {
+  std::string config =
+      "<streams>"
+      "    <item>"
+      "        <commod>stream1</commod>"
+      "        <info>"
+      "            <buf_size>-1</buf_size>"
+      "            <efficiencies>"
+      "                <item><comp>Pu</comp> <eff>1.0</eff></item>"
+      "            </efficiencies>"
+      "        </info>"
+      "    </item>"
+      "</streams>"
+      ""
+      "<leftover_commod>waste</leftover_commod>"
+      "<throughput>10</throughput>"
+      "<feedbuf_size>1000</feedbuf_size>"
+      "<feed_commods> <val>feed</val> </feed_commods>"
+      "<request_horizon>2</request_horizon>"
+     ;
+
+  CompMap m;
+  m[id("u238")] = 0.9;
+  m[id("Pu239")] = .1;
+  Composition::Ptr c = Composition::CreateFromMass(m);
+
+  int simdur = 2;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Separations"), config, simdur);
+  sim.AddSource("feed").recipe("recipe1").capacity(1000).Finalize();
+  sim.AddRecipe("recipe1", c);
+  int id = sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("ReceiverId", "==", id));
+  QueryResult qr = sim.db().Query("Transactions", &conds);
+  ASSERT_EQ(2, qr.rows.size());
+  for (int i = 0; i < qr.rows.size(); i++) {
+    Material::Ptr mat = sim.GetMaterial(qr.GetVal<int>("ResourceId", i));
+    // 20 kg up front, then the 10 kg processed at t=1
+    double want = qr.GetVal<int>("Time", i) == 0 ? 20 : 10;
+    EXPECT_NEAR(want, mat->quantity(), 1e-10);
+  }
+}
+
+// Requests over the horizon are also limited by the stream rate limits and
+// by the room left in the leftover buffer.
+TEST(SeparationsTests, RequestHorizonLimits) {
+  std::string streams =
+      "<streams>"
+      "    <item>"
+      "        <commod>stream1</commod>"
+      "        <info>"
+      "            <buf_size>-1</buf_size>"
+      "            <efficiencies>"
+      "                <item><comp>Pu</comp> <eff>1.0</eff></item>"
+      "            </efficiencies>"
+      "        </info>"
+      "    </item>"
+      "</streams>"
+      ""
+      "<leftover_commod>waste</leftover_commod>"
+      "<throughput>10</throughput>"
+      "<feedbuf_size>1000</feedbuf_size>"
+      "<feed_commods> <val>feed</val> </feed_commods>"
+      "<feed_recipe>recipe1</feed_recipe>"
+      "<request_horizon>2</request_horizon>"
+     ;
+
+  CompMap m;
+  m[id("u238")] = 0.9;
+  m[id("Pu239")] = .1;
+  Composition::Ptr c = Composition::CreateFromMass(m);
+
+  // 0.5 kg/step of Pu separates 5 kg/step of feed, so 10 kg over the horizon
+  std::string rate_config = streams +
+      "<stream_rate_limits>"
+      "    <item><stream>stream1</stream><rate>0.5</rate></item>"
+      "</stream_rate_limits>";
+  cyclus::MockSim rate_sim(cyclus::AgentSpec(":cycamore:Separations"),
+                           rate_config, 1);
+  rate_sim.AddSource("feed").recipe("recipe1").Finalize();
+  rate_sim.AddRecipe("recipe1", c);
+  int id = rate_sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("ReceiverId", "==", id));
+  QueryResult qr = rate_sim.db().Query("Transactions", &conds);
+  ASSERT_EQ(1, qr.rows.size());
+  Material::Ptr mat = rate_sim.GetMaterial(qr.GetVal<int>("ResourceId"));
+  EXPECT_NEAR(10, mat->quantity(), 1e-10);
+
+  // 9 kg of leftover room takes the leftovers of 10 kg of feed
+  std::string leftover_config = streams +
+      "<leftoverbuf_size>9</leftoverbuf_size>";
+  cyclus::MockSim leftover_sim(cyclus::AgentSpec(":cycamore:Separations"),
+                               leftover_config, 1);
+  leftover_sim.AddSource("feed").recipe("recipe1").Finalize();
+  leftover_sim.AddRecipe("recipe1", c);
+  id = leftover_sim.Run();
+
+  conds.clear();
+  conds.push_back(Cond("ReceiverId", "==", id));
+  qr = leftover_sim.db().Query("Transactions", &conds);
+  ASSERT_EQ(1, qr.rows.size());
+  mat = leftover_sim.GetMaterial(qr.GetVal<int>("ResourceId"));
+  EXPECT_NEAR(10, mat->quantity(), 1e-10);
+}
+
+// A rate-limited stream holds back feed, while a spilling stream that is full
+// sends its excess to leftovers instead.
+TEST(SeparationsTests, RateLimitAndSpill) {
+  std::string config =
+      "<streams>"
+      "    <item>"
+      "        <commod>pu</commod>"
+      "        <info>"
+      "            <buf_size>-1</buf_size>"
+      "            <efficiencies>"
+      "                <item><comp>Pu</comp> <eff>1.0</eff></item>"
+      "            </efficiencies>"
+      "        </info>"
+      "    </item>"
+      "    <item>"
+      "        <commod>am</commod>"
+      "        <info>"
+      "            <buf_size>0.5</buf_size>"
+      "            <efficiencies>"
+      "                <item><comp>Am</comp> <eff>1.0</eff></item>"
+      "            </efficiencies>"
+      "        </info>"
+      "    </item>"
+      "</streams>"
+      ""
+      "<leftover_commod>waste</leftover_commod>"
+      "<throughput>100</throughput>"
+      "<feedbuf_size>100</feedbuf_size>"
+      "<feed_commods> <val>feed</val> </feed_commods>"
+      "<stream_rate_limits>"
+      "    <item><stream>pu</stream> <rate>8</rate></item>"
+      "</stream_rate_limits>"
+      "<spill_streams> <val>am</val> </spill_streams>"
+     ;
+
+  CompMap m;
+  m[id("u238")] = 0.89;
+  m[id("Pu239")] = .1;
+  m[id("Am241")] = .01;
+  Composition::Ptr c = Composition::CreateFromMass(m);
+
+  int simdur = 2;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Separations"), config, simdur);
+  sim.AddSource("feed").recipe("recipe1").capacity(100).lifetime(1).Finalize();
+  sim.AddSink("pu").capacity(100).Finalize();
+  sim.AddRecipe("recipe1", c);
+  int id = sim.Run();
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("SenderId", "==", id));
+  QueryResult qr = sim.db().Query("Transactions", &conds);
+  ASSERT_EQ(1, qr.rows.size());
+  Material::Ptr pu = sim.GetMaterial(qr.GetVal<int>("ResourceId"));
+  EXPECT_NEAR(8, pu->quantity(), 1e-10);
+
+  // pu holds back 20% of the feed; am gets 0.8 kg of which 0.3 kg spills
+  conds.clear();
+  conds.push_back(Cond("AgentId", "==", id));
+  conds.push_back(Cond("Stream", "==", std::string("pu")));
+  qr = sim.db().Query("SeparationsThrottle", &conds);
+  EXPECT_NEAR(20, qr.GetVal<double>("FeedHeld"), 1e-10);
+  EXPECT_DOUBLE_EQ(0, qr.GetVal<double>("Spilled"));
+
+  conds.clear();
+  conds.push_back(Cond("AgentId", "==", id));
+  conds.push_back(Cond("Stream", "==", std::string("am")));
+  qr = sim.db().Query("SeparationsThrottle", &conds);
+  EXPECT_DOUBLE_EQ(0, qr.GetVal<double>("FeedHeld"));
+  EXPECT_NEAR(.3, qr.GetVal<double>("Spilled"), 1e-10);
+}
+
+// A full leftover buffer holds back feed, counting both the unseparated
+// material and what spilling streams send to it.
+TEST(SeparationsTests, LeftoverFull) {
+  std::string config =
+      "<streams>"
+      "    <item>"
+      "        <commod>pu</commod>"
+      "        <info>"
+      "            <buf_size>-1</buf_size>"
+      "            <efficiencies>"
+      "                <item><comp>Pu</comp> <eff>1.0</eff></item>"
+      "            </efficiencies>"
+      "        </info>"
+      "    </item>"
+      "    <item>"
+      "        <commod>am</commod>"
+      "        <info>"
+      "            <buf_size>0.5</buf_size>"
+      "            <efficiencies>"
+      "                <item><comp>Am</comp> <eff>1.0</eff></item>"
+      "            </efficiencies>"
+      "        </info>"
+      "    </item>"
+      "</streams>"
+      ""
+      "<leftover_commod>waste</leftover_commod>"
+      "<leftoverbuf_size>50</leftoverbuf_size>"
+      "<throughput>100</throughput>"
+      "<feedbuf_size>100</feedbuf_size>"
+      "<feed_commods> <val>feed</val> </feed_commods>"
+      "<spill_streams> <val>am</val> </spill_streams>"
+     ;
+
+  CompMap m;
+  m[id("u238")] = 0.89;
+  m[id("Pu239")] = .1;
+  m[id("Am241")] = .01;
+  Composition::Ptr c = Composition::CreateFromMass(m);
+
+  int simdur = 2;
+  cyclus::MockSim sim(cyclus::AgentSpec(":cycamore:Separations"), config, simdur);
+  sim.AddSource("feed").recipe("recipe1").capacity(100).lifetime(1).Finalize();
+  sim.AddRecipe("recipe1", c);
+  int id = sim.Run();
+
+  // processing a fraction f of the 100 kg of feed leaves 89 f kg unseparated,
+  // and am spills once f passes 0.5, so leftovers fill at
+  // 89 f + (f - 0.5) = 50
+  double unsep = 89;
+  double am_full = 0.5;
+  double f = (50 + am_full) / (unsep + 1);
+  ASSERT_GT(f, am_full);
+
+  std::vector<Cond> conds;
+  conds.push_back(Cond("AgentId", "==", id));
+  conds.push_back(Cond("Stream", "==", std::string("waste")));
+  QueryResult qr = sim.db().Query("SeparationsThrottle", &conds);
+  ASSERT_EQ(1, qr.rows.size());
+  EXPECT_NEAR(100 * (1 - f), qr.GetVal<double>("FeedHeld"), 1e-8);
+
+  conds.clear();
+  conds.push_back(Cond("AgentId", "==", id));
+  conds.push_back(Cond("Stream", "==", std::string("am")));
+  qr = sim.db().Query("SeparationsThrottle", &conds);
+  EXPECT_NEAR(f - am_full, qr.GetVal<double>("Spilled"), 1e-8);
+}
+
 TEST(SeparationsTests, Retire) {
   std::string config =
       "<streams>"
@@ -340,5 +881,144 @@ TEST(SeparationsTests, Retire) {
   EXPECT_EQ(3.0, qr.rows.size())
       << "failed to discharge all material before decomissioning";
  }  
+
+// InitInv restores the leftover and feed inventories to their own buffers
+// only, not to stream buffers of the same name.
+TEST(SeparationsTests, InitInvReservedNames) {
+  cyclus::TestContext tc;
+  CompMap m;
+  m[id("u238")] = 0.9;
+  m[id("Pu239")] = .1;
+  Composition::Ptr c = Composition::CreateFromMass(m);
+
+  cyclus::Inventories invs;
+  invs["feed-inv-name"].push_back(Material::CreateUntracked(10, c));
+  invs["stream1"].push_back(Material::CreateUntracked(2, c));
+  Separations sep(tc.get());
+  sep.InitInv(invs);
+  cyclus::Inventories restored = sep.SnapshotInv();
+  EXPECT_EQ(2, restored.size());
+  ASSERT_EQ(1, restored["feed-inv-name"].size());
+  EXPECT_DOUBLE_EQ(10, restored["feed-inv-name"][0]->quantity());
+  ASSERT_EQ(1, restored["stream1"].size());
+  EXPECT_DOUBLE_EQ(2, restored["stream1"][0]->quantity());
+
+  // unprocessed feed doesn't hold up decommissioning, but a stream buffer
+  // holding it would
+  cyclus::Inventories feed_only;
+  feed_only["feed-inv-name"].push_back(Material::CreateUntracked(10, c));
+  Separations fed(tc.get());
+  fed.InitInv(feed_only);
+  EXPECT_TRUE(fed.CheckDecommissionCondition());
+}
+
+// Gives tests access to the pipeline state of a Separations facility.
+class SeparationsTest : public ::testing::Test {
+ protected:
+  typedef std::multiset<std::tuple<int, int, double> > LotSet;
+
+  void SetStages(Separations* sep, std::vector<int> durations,
+                 std::vector<double> capacities) {
+    sep->stage_durations = durations;
+    sep->stage_capacities = capacities;
+  }
+
+  void StartStep(Separations* sep) {
+    sep->SizePipeline_();
+    sep->StartPipelineStep_();
+  }
+
+  // puts mat into stage as if it had come through the earlier stages
+  void EnterStage(Separations* sep, int stage, Material::Ptr mat) {
+    if (stage > 0) {
+      sep->pipeline_qty_ += mat->quantity();
+    }
+    sep->EnterStage_(stage, mat);
+  }
+
+  // stage, ready time and quantity of each in-process lot, with a ready time
+  // of -1 for lots waiting on the next stage
+  LotSet Lots(Separations* sep) {
+    LotSet lots;
+    for (int i = 0; i < sep->calendar_.size(); i++) {
+      for (int j = 0; j < sep->calendar_[i].size(); j++) {
+        const Separations::PipeLot& lot = sep->calendar_[i][j];
+        EXPECT_EQ(i, lot.ready % static_cast<int>(sep->calendar_.size()));
+        lots.insert(std::make_tuple(lot.stage, lot.ready,
+                                    lot.mat->quantity()));
+      }
+    }
+    for (int i = 0; i < sep->waiting_.size(); i++) {
+      for (int j = 0; j < sep->waiting_[i].size(); j++) {
+        lots.insert(std::make_tuple(i, -1, sep->waiting_[i][j]->quantity()));
+      }
+    }
+    return lots;
+  }
+
+  std::vector<double> StageRoom(Separations* sep) { return sep->stage_room_; }
+
+  double PipelineQty(Separations* sep) { return sep->pipeline_qty_; }
+};
+
+// A facility holding lots at different pipeline stages is restored from its
+// snapshot with each lot at the same stage and ready time.
+TEST_F(SeparationsTest, PipelineRoundTrip) {
+  cyclus::TestContext tc;
+  CompMap m;
+  m[id("u238")] = 0.9;
+  m[id("Pu239")] = .1;
+  Composition::Ptr c = Composition::CreateFromMass(m);
+
+  std::vector<int> durations;
+  durations.push_back(1);
+  durations.push_back(2);
+  durations.push_back(0);
+  std::vector<double> capacities;
+  capacities.push_back(100);
+  capacities.push_back(30);
+
+  Separations orig(tc.get());
+  SetStages(&orig, durations, capacities);
+  StartStep(&orig);
+  EnterStage(&orig, 0, Material::CreateUntracked(10, c));  // ready at t=1
+  EnterStage(&orig, 1, Material::CreateUntracked(4, c));  // ready at t=2
+  EnterStage(&orig, 2, Material::CreateUntracked(2, c));  // waiting
+  std::vector<double> room = StageRoom(&orig);
+  ASSERT_EQ(3, room.size());
+  EXPECT_DOUBLE_EQ(90, room[0]);
+  EXPECT_DOUBLE_EQ(26, room[1]);
+
+  LotSet lots = Lots(&orig);
+  ASSERT_EQ(3, lots.size());
+  EXPECT_EQ(1, lots.count(std::make_tuple(0, 1, 10.0)));
+  EXPECT_EQ(1, lots.count(std::make_tuple(1, 2, 4.0)));
+  EXPECT_EQ(1, lots.count(std::make_tuple(2, -1, 2.0)));
+
+  cyclus::Inventories invs = orig.SnapshotInv();
+  Separations restored(tc.get());
+  SetStages(&restored, durations, capacities);
+  restored.InitInv(invs);
+  EXPECT_EQ(lots, Lots(&restored));
+  EXPECT_DOUBLE_EQ(16, PipelineQty(&restored));
+
+  cyclus::Inventories again = restored.SnapshotInv();
+  ASSERT_EQ(invs.size(), again.size());
+  cyclus::Inventories::iterator it;
+  for (it = invs.begin(); it != invs.end(); ++it) {
+    ASSERT_EQ(it->second.size(), again[it->first].size()) << it->first;
+  }
+
+  // stage room is only used within a time step and is reset at its start,
+  // so the restored facility has the same room as the original from then on
+  ASSERT_EQ(room.size(), StageRoom(&restored).size());
+  StartStep(&orig);
+  StartStep(&restored);
+  EXPECT_EQ(StageRoom(&orig), StageRoom(&restored));
+  EXPECT_DOUBLE_EQ(100, StageRoom(&restored)[0]);
+  EXPECT_DOUBLE_EQ(30, StageRoom(&restored)[1]);
+  EXPECT_EQ(lots, Lots(&restored));
+}
+
 } // namespace cycamore
 
@@ -0,0 +1,28 @@
+#ifndef CYCAMORE_SRC_SNAPSHOT_BUF_H_
+#define CYCAMORE_SRC_SNAPSHOT_BUF_H_
+
+#include <string>
+#include <vector>
+
+#include "cyclus.h"
+
+namespace cycamore {
+
+/// Adds the contents of buf to invs under name, for archetypes that write
+/// their SnapshotInv by hand.  ResBuf can only be read by popping, so
+/// non-empty buffers are drained and refilled in place; empty ones are left
+/// alone.
+inline void SnapshotBuf(const std::string& name,
+                        cyclus::toolkit::ResBuf<cyclus::Material>* buf,
+                        cyclus::Inventories* invs) {
+  if (buf->count() == 0) {
+    return;
+  }
+  std::vector<cyclus::Resource::Ptr>& rs = (*invs)[name];
+  rs = buf->PopNRes(buf->count());
+  buf->Push(rs);
+}
+
+}  // namespace cycamore
+
+#endif  // CYCAMORE_SRC_SNAPSHOT_BUF_H_
@@ -157,18 +157,21 @@ void Storage::AddMat_(cyclus::Material::Ptr mat) {
 
 //- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 void Storage::BeginProcessing_() {
-  while (inventory.count() > 0) {
-    try {
-      processing.Push(inventory.Pop());
-      entry_times.push_back(context()->time());
+  int n = inventory.count();
+  if (n == 0) {
+    return;
+  }
 
-      LOG(cyclus::LEV_DEBUG2, "ComCnv")
-          << "Storage " << prototype()
-          << " added resources to processing at t= " << context()->time();
-    } catch (cyclus::Error& e) {
-      e.msg(Agent::InformErrorMsg(e.msg()));
-      throw e;
-    }
+  try {
+    processing.Push(inventory.PopN(n));
+    entry_counts[context()->time()] += n;
+
+    LOG(cyclus::LEV_DEBUG2, "ComCnv")
+        << "Storage " << prototype() << " added " << n
+        << " resources to processing at t= " << context()->time();
+  } catch (cyclus::Error& e) {
+    e.msg(Agent::InformErrorMsg(e.msg()));
+    throw e;
   }
 }
 
@@ -212,12 +215,15 @@ void Storage::ProcessMat_(double cap) {
 void Storage::ReadyMatl_(int time) {
   using cyclus::toolkit::ResBuf;
 
+  // entry times are in buffer order, so everything entered by time is at the
+  // front of processing
   int to_ready = 0;
-
-  while (!entry_times.empty() && entry_times.front() <= time) {
-    entry_times.pop_front();
-    ++to_ready;
+  std::map<int, int>::iterator end = entry_counts.upper_bound(time);
+  std::map<int, int>::iterator it;
+  for (it = entry_counts.begin(); it != end; ++it) {
+    to_ready += it->second;
   }
+  entry_counts.erase(entry_counts.begin(), end);
 
   ready.Push(processing.PopN(to_ready));
 }
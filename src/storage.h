@@ -1,8 +1,8 @@
 #ifndef CYCLUS_STORAGES_STORAGE_H_
 #define CYCLUS_STORAGES_STORAGE_H_
 
+#include <map>
 #include <string>
-#include <list>
 #include <vector>
 
 #include "cyclus.h"
@@ -199,10 +199,11 @@ class Storage
   #pragma cyclus var {"tooltip":"Buffer for material held for required residence_time"}
   cyclus::toolkit::ResBuf<cyclus::Material> ready;
 
-  //// list of input times for materials entering the processing buffer
-  #pragma cyclus var{"default": [],\
+  //// number of materials entering the processing buffer at each time step,
+  //// in the same order as the buffer
+  #pragma cyclus var{"default": {},\
                       "internal": True}
-  std::list<int> entry_times;
+  std::map<int, int> entry_counts;
 
   #pragma cyclus var {"tooltip":"Buffer for material still waiting for required residence_time"}
   cyclus::toolkit::ResBuf<cyclus::Material> processing;
@@ -86,6 +86,11 @@ void StorageTest::TestReadyTime(Storage* fac, int t){
   EXPECT_EQ(t, fac->ready_time());
 }
 
+void StorageTest::TestEntryCounts(Storage* fac, int ntimes){
+
+  EXPECT_EQ(ntimes, fac->entry_counts.size());
+}
+
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 TEST_F(StorageTest, clone) {
   Storage* cloned_fac =
@@ -246,6 +251,39 @@ TEST_F(StorageTest, MultipleSmallBatches) {
 }
 
 
+TEST_F(StorageTest, ManyLotsPerStep) {
+  // lots entering processing in the same time step share one entry
+  max_inv_size = 10000;
+  throughput = 1000;
+  SetUpStorage();
+  cyclus::Composition::Ptr rec = tc_.get()->GetRecipe(in_r1);
+  for (int i = 0; i < 3; i++) {
+    TestAddMat(src_facility_, cyclus::Material::CreateUntracked(1, rec));
+  }
+  EXPECT_NO_THROW(src_facility_->Tock());
+  TestBuffers(src_facility_,0,3,0,0);
+  TestEntryCounts(src_facility_,1);
+
+  tc_.get()->time(2);
+  for (int i = 0; i < 2; i++) {
+    TestAddMat(src_facility_, cyclus::Material::CreateUntracked(2, rec));
+  }
+  EXPECT_NO_THROW(src_facility_->Tock());
+  TestBuffers(src_facility_,0,7,0,0);
+  TestEntryCounts(src_facility_,2);
+
+  // only the first step's lots are ready
+  tc_.get()->time(residence_time);
+  EXPECT_NO_THROW(src_facility_->Tock());
+  TestBuffers(src_facility_,0,4,0,3);
+  TestEntryCounts(src_facility_,1);
+
+  tc_.get()->time(residence_time+2);
+  EXPECT_NO_THROW(src_facility_->Tock());
+  TestBuffers(src_facility_,0,0,0,7);
+  TestEntryCounts(src_facility_,0);
+}
+
 TEST_F(StorageTest, ChangeCapacity) {
   // src_facility_->discrete_handling_(0);
   max_inv_size = 10000;
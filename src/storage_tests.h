@@ -27,6 +27,7 @@ class StorageTest : public ::testing::Test {
       proc, double ready, double stocks);
   void TestStocks(storage::Storage* fac, cyclus::CompMap v);
   void TestReadyTime(storage::Storage* fac, int t);
+  void TestEntryCounts(storage::Storage* fac, int ntimes);
   void TestCurrentCap(storage::Storage* fac, double inv);
 
   std::vector<std::string> in_c1, out_c1;
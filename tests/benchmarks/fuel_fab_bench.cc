@@ -0,0 +1,320 @@
+// Benchmarks the FuelFab blending kernels (CosiWeight, AtomToMassFrac) and
+// bid generation against real-scale compositions, and checks the numeric
+// results against golden values so that optimizations to these kernels can be
+// verified.
+//
+// Usage:
+//
+//     cycamore_fuel_fab_bench [--data DIR] [--golden FILE] [--update-golden]
+//                             [--rtol TOL]
+//
+// Compositions are read from DIR (default: the data directory next to this
+// file) as whitespace separated "<nuclide> <mass fraction>" lines, with '#'
+// starting a comment.  Results are compared against FILE (default:
+// DIR/fuel_fab_golden.txt) with a relative tolerance of TOL (default: 0, i.e.
+// bit-for-bit).  --update-golden rewrites FILE from the current results
+// instead of checking them.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cyclus.h"
+#include "test_context.h"
+
+#include "fuel_fab.h"
+
+#ifndef FUEL_FAB_BENCH_DATA_DIR
+#define FUEL_FAB_BENCH_DATA_DIR "data"
+#endif
+
+using cyclus::Composition;
+using cyclus::Material;
+
+namespace {
+
+typedef std::map<std::string, double> Results;
+
+// Builds a FuelFab prototype from an input snippet through MockSim, the same
+// way the unit tests configure agents, and fills its filler and fissile
+// inventories through the exchange API.
+class BenchFab {
+ public:
+  BenchFab(Composition::Ptr c_fill, Composition::Ptr c_fiss,
+           const std::string& spectrum)
+      : sim_(cyclus::AgentSpec(":cycamore:FuelFab"), Config(spectrum), 1) {
+    sim_.AddRecipe("bench_fill", c_fill);
+    sim_.AddRecipe("bench_fiss", c_fiss);
+    fab_ = dynamic_cast<cycamore::FuelFab*>(sim_.agent);
+    if (fab_ == NULL) {
+      throw cyclus::StateError("MockSim did not build a FuelFab");
+    }
+
+    std::vector<std::pair<cyclus::Trade<Material>, Material::Ptr> > resps;
+    std::set<cyclus::RequestPortfolio<Material>::Ptr> ports =
+        fab_->GetMatlRequests();
+    std::set<cyclus::RequestPortfolio<Material>::Ptr>::iterator it;
+    for (it = ports.begin(); it != ports.end(); ++it) {
+      const std::vector<cyclus::Request<Material>*>& reqs = (*it)->requests();
+      for (int i = 0; i < reqs.size(); i++) {
+        Composition::Ptr c;
+        if (reqs[i]->commodity() == "bench_fill") {
+          c = c_fill;
+        } else if (reqs[i]->commodity() == "bench_fiss") {
+          c = c_fiss;
+        } else {
+          continue;
+        }
+        cyclus::Trade<Material> trade(reqs[i], NULL, 1e8);
+        resps.push_back(
+            std::make_pair(trade, Material::CreateUntracked(1e8, c)));
+      }
+    }
+    fab_->AcceptMatlTrades(resps);
+  }
+
+  cycamore::FuelFab* fab() { return fab_; }
+
+  static std::string outcommod() { return "bench_fuel"; }
+
+ private:
+  static std::string Config(const std::string& spectrum) {
+    return "<fill_commods> <val>bench_fill</val> </fill_commods>"
+           "<fill_commod_prefs> <val>1</val> </fill_commod_prefs>"
+           "<fill_recipe>bench_fill</fill_recipe>"
+           "<fill_size>1e9</fill_size>"
+           "<fiss_commods> <val>bench_fiss</val> </fiss_commods>"
+           "<fiss_commod_prefs> <val>1</val> </fiss_commod_prefs>"
+           "<fiss_recipe>bench_fiss</fiss_recipe>"
+           "<fiss_size>1e9</fiss_size>"
+           "<outcommod>bench_fuel</outcommod>"
+           "<spectrum>" + spectrum + "</spectrum>"
+           "<throughput>1e299</throughput>";
+  }
+
+  cyclus::MockSim sim_;
+  cycamore::FuelFab* fab_;
+};
+
+Composition::Ptr ReadComp(const std::string& path) {
+  std::ifstream in(path.c_str());
+  if (!in.good()) {
+    throw cyclus::IOError("could not open composition file " + path);
+  }
+
+  cyclus::CompMap m;
+  std::string line;
+  while (std::getline(in, line)) {
+    line = line.substr(0, line.find('#'));
+    std::stringstream ss(line);
+    std::string nuc;
+    double frac;
+    if (ss >> nuc >> frac) {
+      m[pyne::nucname::id(nuc)] += frac;
+    }
+  }
+  if (m.empty()) {
+    throw cyclus::ValueError("no nuclides found in composition file " + path);
+  }
+  return Composition::CreateFromMass(m);
+}
+
+// Returns the mean time in microseconds of n calls to f.
+template <class F>
+double Time(F f, int n) {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) {
+    f();
+  }
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / n;
+}
+
+void Report(const std::string& name, int n, double usec) {
+  std::printf("%-50s %8d calls %14.3f us/call\n", name.c_str(), n, usec);
+}
+
+Results ReadGolden(const std::string& path) {
+  Results golden;
+  std::ifstream in(path.c_str());
+  std::string key;
+  double val;
+  while (in >> key >> val) {
+    golden[key] = val;
+  }
+  return golden;
+}
+
+void WriteGolden(const std::string& path, const Results& results) {
+  std::ofstream out(path.c_str());
+  out.precision(17);
+  Results::const_iterator it;
+  for (it = results.begin(); it != results.end(); ++it) {
+    out << it->first << " " << it->second << "\n";
+  }
+}
+
+// Returns the number of results that don't match their golden value.
+int Check(const Results& results, const Results& golden, double rtol) {
+  int nfail = 0;
+  Results::const_iterator it;
+  for (it = results.begin(); it != results.end(); ++it) {
+    Results::const_iterator want = golden.find(it->first);
+    if (want == golden.end()) {
+      std::printf("MISSING  %s = %.17g\n", it->first.c_str(), it->second);
+      nfail++;
+      continue;
+    }
+    double diff = std::abs(it->second - want->second);
+    if (diff > rtol * std::abs(want->second)) {
+      std::printf("MISMATCH %s: got %.17g, want %.17g\n", it->first.c_str(),
+                  it->second, want->second);
+      nfail++;
+    }
+  }
+  return nfail;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string data_dir = FUEL_FAB_BENCH_DATA_DIR;
+  std::string golden_path;
+  bool update = false;
+  double rtol = 0;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--data" && i + 1 < argc) {
+      data_dir = argv[++i];
+    } else if (arg == "--golden" && i + 1 < argc) {
+      golden_path = argv[++i];
+    } else if (arg == "--update-golden") {
+      update = true;
+    } else if (arg == "--rtol" && i + 1 < argc) {
+      rtol = std::atof(argv[++i]);
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--data DIR] [--golden FILE]"
+                << " [--update-golden] [--rtol TOL]\n";
+      return 2;
+    }
+  }
+  if (golden_path.empty()) {
+    golden_path = data_dir + "/fuel_fab_golden.txt";
+  }
+
+  cyclus::Env::SetNucDataPath();
+  cyclus::Logger::ReportLevel() = cyclus::LEV_ERROR;
+
+  const char* names[] = {"natu", "depleted_u", "pu_stream", "spent_uox",
+                         "uox_fresh", "mox_fresh"};
+  const char* spectra[] = {"thermal", "fission_spectrum_ave"};
+  std::map<std::string, Composition::Ptr> comps;
+  for (int i = 0; i < 6; i++) {
+    comps[names[i]] = ReadComp(data_dir + "/" + names[i] + ".txt");
+  }
+
+  Results results;
+  volatile double sink = 0;
+
+  // blending kernels
+  std::map<std::string, Composition::Ptr>::iterator it;
+  for (int s = 0; s < 2; s++) {
+    std::string spectrum = spectra[s];
+    for (it = comps.begin(); it != comps.end(); ++it) {
+      Composition::Ptr c = it->second;
+      std::string key = "CosiWeight." + spectrum + "." + it->first;
+      results[key] = cycamore::CosiWeight(c, spectrum);
+      int n = 10000;
+      Report(key, n, Time([&]() { sink += cycamore::CosiWeight(c, spectrum); },
+                          n));
+    }
+  }
+
+  Composition::Ptr c_fill = comps["depleted_u"];
+  Composition::Ptr c_fiss = comps["pu_stream"];
+  const char* tgts[] = {"uox_fresh", "mox_fresh"};
+  for (int t = 0; t < 2; t++) {
+    std::string spectrum = "thermal";
+    double w_fill = cycamore::CosiWeight(c_fill, spectrum);
+    double w_fiss = cycamore::CosiWeight(c_fiss, spectrum);
+    double w_tgt = cycamore::CosiWeight(comps[tgts[t]], spectrum);
+    double frac = cycamore::HighFrac(w_fill, w_tgt, w_fiss);
+    std::string key = std::string("AtomToMassFrac.") + tgts[t];
+    results[key] = cycamore::AtomToMassFrac(frac, c_fiss, c_fill);
+    int n = 10000;
+    Report(key, n, Time([&]() {
+             sink += cycamore::AtomToMassFrac(frac, c_fiss, c_fill);
+           }, n));
+  }
+
+  // bid generation at increasing request counts
+  int nreqs[] = {1, 10, 100, 1000};
+  for (int s = 0; s < 2; s++) {
+    std::string spectrum = spectra[s];
+    cyclus::TestContext tc;
+    BenchFab bench(c_fill, c_fiss, spectrum);
+    cycamore::FuelFab* fab = bench.fab();
+    std::string commod = BenchFab::outcommod();
+
+    for (int r = 0; r < 4; r++) {
+      int nreq = nreqs[r];
+      cyclus::CommodMap<Material>::type reqs;
+      for (int j = 0; j < nreq; j++) {
+        Material::Ptr tgt = Material::CreateUntracked(
+            1000 + j, comps[tgts[j % 2]]);
+        reqs[commod].push_back(
+            cyclus::Request<Material>::Create(tgt, tc.trader(), commod));
+      }
+
+      double tot = 0;
+      int nbids = 0;
+      std::set<cyclus::BidPortfolio<Material>::Ptr> ports =
+          fab->GetMatlBids(reqs);
+      std::set<cyclus::BidPortfolio<Material>::Ptr>::iterator pit;
+      for (pit = ports.begin(); pit != ports.end(); ++pit) {
+        std::set<cyclus::Bid<Material>*>::const_iterator bit;
+        for (bit = (*pit)->bids().begin(); bit != (*pit)->bids().end();
+             ++bit) {
+          tot += (*bit)->offer()->quantity();
+          nbids++;
+        }
+      }
+
+      std::stringstream key;
+      key << "GetMatlBids." << spectrum << "." << nreq;
+      results[key.str() + ".bids"] = nbids;
+      results[key.str() + ".qty"] = tot;
+      int n = std::max(1, 1000 / nreq);
+      Report(key.str(), n, Time([&]() {
+               sink += fab->GetMatlBids(reqs).size();
+             }, n));
+    }
+  }
+
+  if (update) {
+    WriteGolden(golden_path, results);
+    std::cout << "wrote " << results.size() << " golden values to "
+              << golden_path << "\n";
+    return 0;
+  }
+
+  Results golden = ReadGolden(golden_path);
+  if (golden.empty()) {
+    std::cout << "no golden values found at " << golden_path
+              << " - rerun with --update-golden to create them\n";
+    return 1;
+  }
+  int nfail = Check(results, golden, rtol);
+  std::cout << results.size() - nfail << " of " << results.size()
+            << " values match golden values (rtol=" << rtol << ")\n";
+  return nfail == 0 ? 0 : 1;
+}